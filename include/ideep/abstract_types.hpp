@@ -1,11 +1,13 @@
 #ifndef _ABSTRACT_TYPES_HPP_
 #define _ABSTRACT_TYPES_HPP_
 
+#include <cstdlib>
 #include <string>
 #include <map>
 #include <vector>
 #include <mkldnn.h>
 #include <mkldnn.hpp>
+#include "utils.hpp"
 
 namespace ideep {
 
@@ -166,7 +168,32 @@ struct engine: public mkldnn::engine {
     return cpu_engine; \
   }
 
+  /// Whether activations are laid out channels-last (nhwc, ndhwc), so
+  /// that they are reordered only when asked for another format. Off
+  /// unless set_channels_last() turns it on; convolution and pooling key
+  /// their cached computations by the mode.
+  inline static bool channels_last() {
+    return channels_last_flag();
+  }
+
+  inline static void set_channels_last(bool enabled) {
+    channels_last_flag() = enabled;
+  }
+
+  /// Format of user buffers and of tensors whose layout is not chosen
+  /// by a primitive, follows the channels-last mode for 4D and 5D.
   inline static format default_format(int ndims) {
+    if (channels_last()) {
+      if (ndims == 4)
+        return format::nhwc;
+      if (ndims == 5)
+        return format::ndhwc;
+    }
+    return plain_format(ndims);
+  }
+
+  /// Row-major format of the logical dims, regardless of the mode.
+  inline static format plain_format(int ndims) {
     switch(ndims) {
     case 1:
       return format::x;
@@ -184,6 +211,11 @@ struct engine: public mkldnn::engine {
   }
 
 private:
+  static bool& channels_last_flag() {
+    static bool channels_last_ = false;
+    return channels_last_;
+  }
+
   /// Constructs an engine.
   ///
   /// @param akind The kind of engine to construct.
@@ -202,7 +234,7 @@ struct stream: public mkldnn::stream {
   }
 };
 
-using key_t = std::string;
+using key_t = utils::hash_key;
 
 using kind = mkldnn::primitive::kind;
 using prop_kind = mkldnn::prop_kind;
@@ -26,8 +26,31 @@
 #define IDEEP_ALLOCATOR_HPP
 
 #include <mutex>
+#include <memory>
 #include <list>
-#include <sstream>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <map>
+#include <limits>
+#include <cstdio>
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include "utils.hpp"
 
 namespace ideep {
 
@@ -84,12 +107,776 @@ public:
   };
 };
 
+#define GET_PTR(t, p, offset) \
+    (reinterpret_cast<t*>(reinterpret_cast<size_t>(p) + \
+    static_cast<size_t>(offset)))
+
+/// NUMA topology and memory policy, through sysfs and raw syscalls so
+/// that libnuma is not a dependency. Every call degrades to a no-op on a
+/// single node or non-Linux system.
+namespace numa {
+
+// Parse a sysfs list like "0-3,8-11"
+inline std::vector<int> parse_list(const char *path) {
+  std::vector<int> ids;
+  std::ifstream in(path);
+  std::string range;
+  while (std::getline(in, range, ',')) {
+    int first, last;
+    auto n = std::sscanf(range.c_str(), "%d-%d", &first, &last);
+    if (n < 1)
+      continue;
+    for (int i = first; i <= (n == 2 ? last : first); i ++)
+      ids.push_back(i);
+  }
+  return ids;
+}
+
+inline int num_nodes() {
+  static int nodes = [] {
+    auto online = parse_list("/sys/devices/system/node/online");
+    return online.empty() ? 1 : online.back() + 1;
+  }();
+  return nodes;
+}
+
+inline std::vector<int> node_cpus(int node) {
+  auto path = "/sys/devices/system/node/node" + std::to_string(node)
+    + "/cpulist";
+  return parse_list(path.c_str());
+}
+
+/// Node of the cpu the calling thread runs on
+inline int current_node() {
+#if defined(__linux__) && defined(SYS_getcpu)
+  unsigned cpu, node;
+  if (num_nodes() > 1 && syscall(SYS_getcpu, &cpu, &node, nullptr) == 0)
+    return static_cast<int>(node);
+#endif
+  return 0;
+}
+
+enum policy {
+  preferred = 1,
+  bind_node = 2,
+  interleave = 3,
+};
+
+/// Set the policy of the pages in [addr, addr + len), moving pages already
+/// faulted in. node < 0 selects every node.
+inline bool set_policy(void *addr, size_t len, policy mode,
+    int node = -1) {
+#if defined(__linux__) && defined(SYS_mbind)
+  if (num_nodes() <= 1)
+    return false;
+
+  unsigned long mask[4] = {0};
+  constexpr int mask_bits = sizeof(mask) * 8;
+  for (int i = 0; i < std::min(num_nodes(), mask_bits); i ++)
+    if (node < 0 || i == node)
+      mask[i / 64] |= 1ul << (i % 64);
+
+  const unsigned long mpol_mf_move = 1 << 1;
+  auto page = reinterpret_cast<size_t>(addr) & ~size_t(4095);
+  len += reinterpret_cast<size_t>(addr) - page;
+  return syscall(SYS_mbind, page, len, static_cast<int>(mode), mask,
+      mask_bits + 1, mpol_mf_move) == 0;
+#else
+  (void)addr; (void)len; (void)mode; (void)node;
+  return false;
+#endif
+}
+
+inline bool bind(void *addr, size_t len, int node) {
+  return set_policy(addr, len, bind_node, node);
+}
+
+/// Cpus the process may run on, node by node. OpenMP thread i is laid out
+/// on the i-th entry by bind_omp_threads.
+inline const std::vector<int> &compact_cpus() {
+  static std::vector<int> cpus = [] {
+    std::vector<int> all;
+#if defined(__linux__)
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+      return all;
+    for (int node = 0; node < num_nodes(); node ++) {
+      for (auto cpu : node_cpus(node))
+        if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+          all.push_back(cpu);
+    }
+#endif
+    return all;
+  }();
+  return cpus;
+}
+
+/// Node OpenMP thread tid runs on after bind_omp_threads
+inline int omp_thread_node(int tid) {
+  auto &cpus = compact_cpus();
+  if (num_nodes() <= 1 || cpus.empty())
+    return 0;
+  int cpu = cpus[tid % cpus.size()];
+  for (int node = 0; node < num_nodes(); node ++) {
+    auto on_node = node_cpus(node);
+    if (std::find(on_node.begin(), on_node.end(), cpu) != on_node.end())
+      return node;
+  }
+  return 0;
+}
+
+/// Pin the threads of the OpenMP team compactly, filling one node before
+/// the next, so that first-touch pages and node-local pools stay local to
+/// the threads that use them.
+inline void bind_omp_threads() {
+#if defined(__linux__)
+  auto &cpus = compact_cpus();
+  if (cpus.empty())
+    return;
+# ifdef _OPENMP
+# pragma omp parallel
+# endif
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus[omp_get_thread_num() % cpus.size()], &set);
+    sched_setaffinity(0, sizeof(set), &set);
+  }
+#endif
+}
+
+}
+
+/// 2MB page backing for large buffers, to cut dTLB misses in conv and
+/// inner product kernels. Explicit huge pages (MAP_HUGETLB) are used when
+/// the system reserved some, otherwise transparent huge pages are requested
+/// with madvise. Disabled unless ENABLE_HUGE_PAGE is set or set_enabled()
+/// is called; HUGE_PAGE_THRESHOLD sets the minimum size in megabytes.
+namespace huge_page {
+
+const size_t page_size = 2 * 1024 * 1024;
+
+inline std::atomic<bool> &enabled() {
+  static std::atomic<bool> enabled_([] {
+    char *env = getenv("ENABLE_HUGE_PAGE");
+    return env != nullptr && *env != '0';
+  }());
+  return enabled_;
+}
+
+inline bool is_enabled() {
+  return enabled().load(std::memory_order_relaxed);
+}
+
+inline void set_enabled(bool on) {
+  enabled().store(on, std::memory_order_relaxed);
+}
+
+inline std::atomic<size_t> &threshold() {
+  static std::atomic<size_t> threshold_([] {
+    char *env = getenv("HUGE_PAGE_THRESHOLD");
+    return env != nullptr
+      ? static_cast<size_t>(std::strtoull(env, nullptr, 10)) << 20
+      : page_size;
+  }());
+  return threshold_;
+}
+
+/// Whether a buffer of size bytes should be mapped here
+inline bool wanted(size_t size) {
+  return is_enabled() && size >= threshold().load(std::memory_order_relaxed);
+}
+
+inline size_t round_up(size_t size) {
+  return (size + page_size - 1) & ~(page_size - 1);
+}
+
+// Mapped regions, by address, and whether they are explicit huge pages
+struct regions {
+  std::mutex mutex_;
+  std::map<size_t, std::pair<size_t, bool>> map_;
+  size_t hugetlb_size_ = 0;
+  size_t mapped_size_ = 0;
+
+  static regions &get() {
+    static regions regions_;
+    return regions_;
+  }
+};
+
+// Ordinary pages mapped below a region for head_room bytes
+inline size_t room_of(size_t head_room) {
+  return (head_room + 4095) & ~size_t(4095);
+}
+
+/// Map size bytes aligned to page_size, nullptr if the system refuses.
+/// head_room bytes below the returned address are mapped with ordinary
+/// pages, so a block header doesn't cost a huge page of its own.
+inline void *map(size_t size, size_t head_room = 0) {
+#if defined(__linux__)
+  auto len = round_up(size);
+  auto room = room_of(head_room);
+  bool hugetlb = true;
+  void *ptr = MAP_FAILED;
+# ifdef MAP_HUGETLB
+  ptr = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (ptr != MAP_FAILED && room != 0) {
+    // A hint only, given up if the pages below are taken
+    auto below = static_cast<char *>(ptr) - room;
+    auto head = mmap(below, room, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (head != below) {
+      if (head != MAP_FAILED)
+        munmap(head, room);
+      munmap(ptr, len);
+      ptr = MAP_FAILED;
+    }
+  }
+# endif
+  if (ptr == MAP_FAILED) {
+    // Over-map and trim, THP only backs 2MB aligned ranges
+    hugetlb = false;
+    auto raw = mmap(nullptr, len + page_size + room, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+      return nullptr;
+    auto start = reinterpret_cast<size_t>(raw);
+    auto end = start + len + page_size + room;
+    auto aligned = (start + room + page_size - 1) & ~(page_size - 1);
+    if (aligned - room > start)
+      munmap(raw, aligned - room - start);
+    if (end > aligned + len)
+      munmap(reinterpret_cast<void *>(aligned + len), end - aligned - len);
+    ptr = reinterpret_cast<void *>(aligned);
+# ifdef MADV_HUGEPAGE
+    madvise(ptr, len, MADV_HUGEPAGE);
+# endif
+  }
+
+  auto &r = regions::get();
+  std::lock_guard<std::mutex> lock(r.mutex_);
+  r.map_[reinterpret_cast<size_t>(ptr)] = std::make_pair(len, hugetlb);
+  r.mapped_size_ += len;
+  if (hugetlb)
+    r.hugetlb_size_ += len;
+  return ptr;
+#else
+  (void)size;
+  return nullptr;
+#endif
+}
+
+/// Unmap a region returned by map, with the same size and head_room
+inline void unmap(void *ptr, size_t size, size_t head_room = 0) {
+#if defined(__linux__)
+  auto len = round_up(size);
+  auto room = room_of(head_room);
+  {
+    auto &r = regions::get();
+    std::lock_guard<std::mutex> lock(r.mutex_);
+    auto it = r.map_.find(reinterpret_cast<size_t>(ptr));
+    if (it != r.map_.end()) {
+      r.mapped_size_ -= len;
+      if (it->second.second)
+        r.hugetlb_size_ -= len;
+      r.map_.erase(it);
+    }
+  }
+  munmap(ptr, len);
+  if (room != 0)
+    munmap(static_cast<char *>(ptr) - room, room);
+#else
+  (void)ptr; (void)size; (void)head_room;
+#endif
+}
+
+/// Bytes mapped for huge pages, backed or not
+inline size_t mapped_size() {
+  auto &r = regions::get();
+  std::lock_guard<std::mutex> lock(r.mutex_);
+  return r.mapped_size_;
+}
+
+/// Bytes of mapped regions actually backed by huge pages: explicit ones,
+/// plus the AnonHugePages the kernel reports in /proc/self/smaps for areas
+/// overlapping transparent ones. An area merged with a neighbouring
+/// mapping is counted in proportion to the overlap.
+inline size_t backed_size() {
+  auto &r = regions::get();
+  std::lock_guard<std::mutex> lock(r.mutex_);
+  size_t backed = r.hugetlb_size_;
+  if (r.mapped_size_ == r.hugetlb_size_)
+    return backed;
+
+  std::ifstream smaps("/proc/self/smaps");
+  std::string line;
+  size_t overlap = 0, area = 0;
+  while (std::getline(smaps, line)) {
+    size_t start, end, kb;
+    if (std::sscanf(line.c_str(), "%zx-%zx ", &start, &end) == 2) {
+      area = end - start;
+      overlap = 0;
+      auto it = r.map_.upper_bound(start);
+      if (it != r.map_.begin())
+        -- it;
+      for (; it != r.map_.end() && it->first < end; ++ it) {
+        if (it->second.second)
+          continue;
+        auto lo = std::max(start, it->first);
+        auto hi = std::min(end, it->first + it->second.first);
+        if (hi > lo)
+          overlap += hi - lo;
+      }
+    } else if (overlap != 0 &&
+        std::sscanf(line.c_str(), "AnonHugePages: %zu kB", &kb) == 1) {
+      backed += static_cast<size_t>(
+          static_cast<double>(kb << 10) * overlap / area);
+    }
+  }
+  return backed;
+}
+
+}
+
+/// Size class pool behind scratch_allocator.
+///
+/// Requests are rounded up to geometric size classes, four per power of
+/// two, so buffers whose sizes differ slightly between batches share
+/// blocks with at most 25% waste. Freed blocks go to a per-thread cache and
+/// overflow in batches to a global depot of lock-free stacks, one per
+/// class. Both malloc and free are O(1) and take no lock.
+///
+/// With a limit set, idle blocks are returned to the system, least
+/// recently freed first, when the pool grows past it, down to 90% of the
+/// limit so the next trim is a while away. The limit is soft: blocks in
+/// use are never reclaimed, nor are those sitting in the caches of other
+/// threads until they spill or exit.
+class slab_pool {
+public:
+  static constexpr size_t min_class_size = 256;
+  static constexpr int num_classes = 4 * 48;
+  // Cached bytes per class a thread keeps before spilling to the depot
+  static constexpr size_t thread_cache_bytes = 64 * 1024 * 1024;
+
+  struct stats_t {
+    size_t alloc_size;     // bytes obtained from the system
+    size_t free_size;      // idle bytes, ready for reuse
+    size_t peak_size;      // high-water mark of alloc_size
+    size_t released_size;  // bytes returned to the system by trimming
+    size_t limit;          // 0 if unlimited
+  };
+
+  static constexpr int max_pools = 64;
+
+  static slab_pool *instance() {
+    static slab_pool pool_;
+    return &pool_;
+  }
+
+  /// The pool a block returned by malloc belongs to
+  static slab_pool *of(void *ptr) {
+    auto head = GET_PTR(header_t, ptr, -SYS_MEMORY_ALIGNMENT);
+    return registry()[head->pool_];
+  }
+
+  /// Pages of a pool with node >= 0 are bound to that NUMA node
+  explicit slab_pool(int node = -1) : alloc_size_(0), free_size_(0),
+      peak_size_(0), released_size_(0), limit_(default_limit()),
+      trim_trigger_(limit_.load()), freed_over_limit_(0), poppers_(0), alignment_(SYS_MEMORY_ALIGNMENT), node_(node) {
+    static std::atomic<int> next_id(0);
+    id_ = next_id ++;
+    if (id_ >= max_pools)
+      throw std::length_error("Too many slab pools");
+    for (auto &d : depot_)
+      d.store(0, std::memory_order_relaxed);
+    registry()[id_] = this;
+    alive(id_) = true;
+  }
+
+  ~slab_pool() {
+    alive(id_) = false;
+    for (int i = 0; i < num_classes; i ++) {
+      while (auto head = depot_pop(i))
+        release(head);
+    }
+  }
+
+  void *malloc(size_t size) {
+    size_t class_size;
+    int cls = size_class(size, class_size);
+    if (cls < 0)
+      return oversize_malloc(size);
+
+    auto &cache = thread_cache::get(this);
+    auto head = cache.pop(cls);
+    if (head == nullptr)
+      head = depot_pop(cls);
+
+    if (head == nullptr) {
+      if (get_limit() != 0 && alloc_size() + class_size
+          > trim_trigger_.load(std::memory_order_relaxed))
+        trim_to_limit(class_size);
+
+      void *ptr = nullptr;
+      bool mapped = huge_page::wanted(class_size);
+      if (mapped) {
+        // The header goes below the huge pages, class sizes often fill them
+        ptr = huge_page::map(class_size, alignment_);
+        mapped = ptr != nullptr;
+        if (mapped)
+          ptr = GET_PTR(void, ptr, -alignment_);
+      }
+      if (!mapped) {
+        ptr = allocator::malloc(class_size + alignment_);
+        if (ptr == nullptr)
+          throw std::invalid_argument("Out of memory");
+      }
+      if (node_ >= 0)
+        numa::bind(ptr, class_size + alignment_, node_);
+      head = static_cast<header_t *>(ptr);
+      head->cls_ = cls;
+      head->mapped_ = mapped;
+      head->pool_ = id_;
+      auto total = alloc_size_.fetch_add(class_size,
+          std::memory_order_relaxed) + class_size;
+      auto peak = peak_size_.load(std::memory_order_relaxed);
+      while (peak < total && !peak_size_.compare_exchange_weak(peak, total,
+            std::memory_order_relaxed));
+    } else {
+      free_size_.fetch_sub(class_size, std::memory_order_relaxed);
+    }
+
+    return GET_PTR(void, head, alignment_);
+  }
+
+  void free(void *ptr) {
+    header_t *head = GET_PTR(header_t, ptr, -alignment_);
+    if (head->cls_ < 0) {
+      allocator::free(head);
+      return;
+    }
+
+    auto class_size = class_to_size(head->cls_);
+    free_size_.fetch_add(class_size, std::memory_order_relaxed);
+    head->last_use_ =
+      std::chrono::steady_clock::now().time_since_epoch().count();
+    thread_cache::get(this).push(head);
+
+    // Over the limit, trim once a tenth of it has become idle
+    auto limit = get_limit();
+    if (limit != 0 && alloc_size() > limit && freed_over_limit_.fetch_add(
+          class_size, std::memory_order_relaxed) + class_size >= limit / 10)
+      trim_to_limit(0);
+  }
+
+  /// Return idle blocks of the depot and of the calling thread to the
+  /// system, least recently freed first, until at most target bytes are
+  /// allocated.
+  void trim(size_t target = 0) {
+    std::lock_guard<std::mutex> lock(trim_mutex_);
+    if (alloc_size() <= target)
+      return;
+
+    std::vector<header_t *> idle;
+    auto &cache = thread_cache::get(this);
+    for (int i = 0; i < num_classes; i ++) {
+      while (auto head = cache.pop(i))
+        idle.push_back(head);
+      for (auto head = depot_detach(i); head != nullptr; head = head->next_)
+        idle.push_back(head);
+    }
+
+    // Poppers that read a detached head may still dereference it
+    while (poppers_.load() != 0)
+      std::this_thread::yield();
+
+    std::sort(idle.begin(), idle.end(),
+        [](const header_t *a, const header_t *b) {
+          return a->last_use_ < b->last_use_;
+        });
+
+    auto it = idle.begin();
+    for (; it != idle.end() && alloc_size() > target; ++ it) {
+      auto class_size = class_to_size((*it)->cls_);
+      alloc_size_.fetch_sub(class_size, std::memory_order_relaxed);
+      free_size_.fetch_sub(class_size, std::memory_order_relaxed);
+      released_size_.fetch_add(class_size, std::memory_order_relaxed);
+      release(*it);
+    }
+
+    for (; it != idle.end(); ++ it)
+      depot_push((*it)->cls_, *it, *it);
+  }
+
+  void set_limit(size_t limit) {
+    limit_.store(limit, std::memory_order_relaxed);
+    trim_trigger_.store(limit, std::memory_order_relaxed);
+    if (limit != 0 && alloc_size() > limit)
+      trim_to_limit(0);
+  }
+
+  size_t get_limit() const {
+    return limit_.load(std::memory_order_relaxed);
+  }
+
+  stats_t stats() const {
+    return { alloc_size(), free_size(),
+      peak_size_.load(std::memory_order_relaxed),
+      released_size_.load(std::memory_order_relaxed), get_limit() };
+  }
+
+  /// Bytes obtained from the system
+  size_t alloc_size() const {
+    return alloc_size_.load(std::memory_order_relaxed);
+  }
+
+  /// Bytes held in caches, ready for reuse
+  size_t free_size() const {
+    return free_size_.load(std::memory_order_relaxed);
+  }
+
+  /// -1 if size is beyond the largest class
+  static inline int size_class(size_t size, size_t &class_size) {
+    if (size <= min_class_size) {
+      class_size = min_class_size;
+      return 0;
+    }
+
+    if (size > class_to_size(num_classes - 1)) {
+      class_size = size;
+      return -1;
+    }
+
+    // size in (2^lg, 2^(lg+1)], split in 4 steps of 2^(lg-2)
+    int lg = msb(size - 1);
+    int shift = lg - 2;
+    size_t sub = (size - 1) >> shift;
+    class_size = (sub + 1) << shift;
+    return 1 + (lg - 8) * 4 + static_cast<int>(sub - 4);
+  }
+
+  static inline size_t class_to_size(int cls) {
+    if (cls == 0)
+      return min_class_size;
+    int lg = (cls - 1) / 4 + 8;
+    size_t sub = (cls - 1) % 4 + 4;
+    return (sub + 1) << (lg - 2);
+  }
+
+private:
+  // Position of the highest set bit, v != 0
+  static inline int msb(uint64_t v) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, v);
+    return static_cast<int>(index);
+#else
+    return 63 - __builtin_clzll(v);
+#endif
+  }
+
+  struct header_t {
+    header_t *next_;
+    int cls_;   // -1 for blocks too large to pool
+    int pool_;
+    bool mapped_;
+    int64_t last_use_;
+  };
+
+  // Free lists of the calling thread, spilled to the depot when a class
+  // holds more than cache_bytes() or when the thread exits.
+  class thread_cache {
+  public:
+    static thread_cache &get(slab_pool *pool) {
+      static thread_local std::unique_ptr<thread_cache> caches_[max_pools];
+      auto &cache = caches_[pool->id_];
+      if (!cache)
+        cache.reset(new thread_cache(pool));
+      return *cache;
+    }
+
+    explicit thread_cache(slab_pool *owner)
+      : owner_(owner), owner_id_(owner->id_) {
+      for (int i = 0; i < num_classes; i ++) {
+        lists_[i] = nullptr;
+        counts_[i] = 0;
+      }
+    }
+
+    ~thread_cache() {
+      for (int i = 0; i < num_classes; i ++) {
+        if (lists_[i] == nullptr)
+          continue;
+        if (alive(owner_id_))
+          owner_->depot_push(i, lists_[i], tail(lists_[i]));
+        else
+          while (auto head = pop(i))
+            release(head);
+      }
+    }
+
+    header_t *pop(int cls) {
+      auto head = lists_[cls];
+      if (head != nullptr) {
+        lists_[cls] = head->next_;
+        counts_[cls] --;
+      }
+      return head;
+    }
+
+    void push(header_t *head) {
+      auto pool = owner_;
+      auto cls = head->cls_;
+      head->next_ = lists_[cls];
+      lists_[cls] = head;
+
+      auto limit = std::max<size_t>(1,
+          pool->cache_bytes() / class_to_size(cls));
+      if (++ counts_[cls] > limit) {
+        // Keep the most recent half, it is the warmest in cache
+        auto keep = lists_[cls];
+        for (size_t i = 1; i < limit / 2 + 1; i ++)
+          keep = keep->next_;
+        auto spill = keep->next_;
+        keep->next_ = nullptr;
+        counts_[cls] = limit / 2 + 1;
+        pool->depot_push(cls, spill, tail(spill));
+      }
+    }
+
+  private:
+    static header_t *tail(header_t *head) {
+      while (head->next_ != nullptr)
+        head = head->next_;
+      return head;
+    }
+
+    slab_pool *owner_;
+    int owner_id_;
+    header_t *lists_[num_classes];
+    size_t counts_[num_classes];
+  };
+
+  // Depot heads pack a 16 bit ABA tag above the 48 bit user address.
+  static constexpr uint64_t ptr_mask = (uint64_t(1) << 48) - 1;
+
+  void depot_push(int cls, header_t *first, header_t *last) {
+    auto &head = depot_[cls];
+    auto old = head.load(std::memory_order_relaxed);
+    uint64_t desired;
+    do {
+      last->next_ = reinterpret_cast<header_t *>(old & ptr_mask);
+      desired = ((old & ~ptr_mask) + (ptr_mask + 1))
+        | reinterpret_cast<uint64_t>(first);
+    } while (!head.compare_exchange_weak(old, desired,
+          std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  header_t *depot_pop(int cls) {
+    auto &head = depot_[cls];
+    poppers_.fetch_add(1);
+    auto old = head.load();
+    header_t *first;
+    uint64_t desired;
+    do {
+      first = reinterpret_cast<header_t *>(old & ptr_mask);
+      if (first == nullptr)
+        break;
+      // trim() waits for us before unmapping, a stale read fails the CAS
+      desired = ((old & ~ptr_mask) + (ptr_mask + 1))
+        | reinterpret_cast<uint64_t>(first->next_);
+    } while (!head.compare_exchange_weak(old, desired));
+    poppers_.fetch_sub(1, std::memory_order_release);
+    return first;
+  }
+
+  header_t *depot_detach(int cls) {
+    auto &head = depot_[cls];
+    auto old = head.load();
+    while (!head.compare_exchange_weak(old,
+          (old & ~ptr_mask) + (ptr_mask + 1)));
+    return reinterpret_cast<header_t *>(old & ptr_mask);
+  }
+
+  static void release(header_t *head) {
+    if (head->mapped_)
+      huge_page::unmap(GET_PTR(void, head, SYS_MEMORY_ALIGNMENT),
+          class_to_size(head->cls_), SYS_MEMORY_ALIGNMENT);
+    else
+      allocator::free(head);
+  }
+
+  // Straight from the system and back to it on free, never cached
+  void *oversize_malloc(size_t size) {
+    void *ptr = nullptr;
+    if (size <= std::numeric_limits<size_t>::max() - alignment_)
+      ptr = allocator::malloc(size + alignment_);
+    if (ptr == nullptr)
+      throw std::invalid_argument("Out of memory");
+    auto head = static_cast<header_t *>(ptr);
+    head->cls_ = -1;
+    head->mapped_ = false;
+    head->pool_ = id_;
+    return GET_PTR(void, head, alignment_);
+  }
+
+  // Trim to 90% of the limit, making room for incoming bytes. When idle
+  // blocks can't cover that, the next trim waits for another tenth of
+  // growth rather than running on every miss.
+  void trim_to_limit(size_t incoming) {
+    auto limit = get_limit();
+    auto target = limit - limit / 10;
+    trim(target > incoming ? target - incoming : 0);
+    freed_over_limit_.store(0, std::memory_order_relaxed);
+    trim_trigger_.store(std::max(limit, alloc_size() + incoming + limit / 10),
+        std::memory_order_relaxed);
+  }
+
+  // Keep most idle memory where trim() can reach it under a limit
+  size_t cache_bytes() const {
+    size_t cache_bytes = thread_cache_bytes;
+    auto limit = get_limit();
+    return limit == 0 ? cache_bytes : std::min(cache_bytes, limit / 4);
+  }
+
+  // SCRATCH_POOL_LIMIT, in megabytes
+  static size_t default_limit() {
+    char *env = getenv("SCRATCH_POOL_LIMIT");
+    if (env == nullptr)
+      return 0;
+    return static_cast<size_t>(std::strtoull(env, nullptr, 10)) << 20;
+  }
+
+  static slab_pool **registry() {
+    static slab_pool *pools_[max_pools];
+    return pools_;
+  }
+
+  // Read by thread caches that may outlive their pool
+  static bool &alive(int id) {
+    static bool alive_[max_pools];
+    return alive_[id];
+  }
+
+  std::atomic<size_t> alloc_size_;
+  std::atomic<size_t> free_size_;
+  std::atomic<size_t> peak_size_;
+  std::atomic<size_t> released_size_;
+  std::atomic<size_t> limit_;
+  std::atomic<size_t> trim_trigger_;
+  std::atomic<size_t> freed_over_limit_;
+  std::atomic<int> poppers_;
+  std::mutex trim_mutex_;
+  const size_t alignment_;
+  const int node_;
+  int id_;
+  std::atomic<uint64_t> depot_[num_classes];
+};
+
 // Default SA implementation (by computation)
 class scratch_allocator {
 public:
-  #define GET_PTR(t, p, offset) \
-      (reinterpret_cast<t*>(reinterpret_cast<size_t>(p) + \
-      static_cast<size_t>(offset)))
 
   static bool is_enabled() {
     static bool enabled = true;
@@ -105,113 +892,188 @@ public:
     return enabled;
   }
 
-  class mpool {
+  using mpool = slab_pool;
+
+  scratch_allocator() = default;
+
+  // Size classes are shared by all computations, a pool per computation
+  // only fragments memory further.
+  template<class computation_t = void>
+  static inline mpool *get_mpool(void) {
+    return slab_pool::instance();
+  }
+
+  static slab_pool::stats_t stats() {
+    return slab_pool::instance()->stats();
+  }
+
+  static void trim(size_t target = 0) {
+    slab_pool::instance()->trim(target);
+  }
+
+  /// Bytes the pool may hold before idle blocks are released, 0 for none
+  static void set_limit(size_t limit) {
+    slab_pool::instance()->set_limit(limit);
+  }
+
+  template<class computation_t = void>
+  static char *malloc(size_t size) {
+    if (!is_enabled())
+      return static_cast<char *>(allocator::malloc(size));
+    else
+      return static_cast<char *>(get_mpool<computation_t>()->malloc(size));
+  }
+
+  template<class computation_t = void>
+  static void free(void *p) {
+    if (!is_enabled())
+      allocator::free(p);
+    else
+      get_mpool<computation_t>()->free(p);
+  }
+
+  template<class computation_t = void>
+  struct byte {
   public:
-    mpool() : alloc_size_(0), free_size_(0),
-        alignment_(SYS_MEMORY_ALIGNMENT), seq_(0) {}
-
-    ~mpool() {
-      std::lock_guard<std::mutex> lock(mutex_);
-      for (int i = 0; i < MAX_ENTRY; ++i) {
-        std::list<header_t *>& l = free_hashline_[i];
-        for (auto& h: l) {
-          ::free(h);
-        }
-      }
+    static void *operator new(size_t sz) {
+      return (void *)malloc<computation_t>(sz);
     }
 
-    void *malloc(size_t size) {
-      std::lock_guard<std::mutex> lock(mutex_);
-      void *ptr;
-      int idx = to_index(size);
-
-      if (!free_hashline_[idx].empty()) {
-        header_t *head = nullptr;
-        std::list<header_t *> &list = free_hashline_[idx];
-        typename std::list<header_t *>::iterator it;
-        for(it = list.begin(); it != list.end(); ++it) {
-          if((*it)->size_ == size) {
-            head = *it;
-            break;
-          }
-        }
-        if (head) {
-          list.erase(it);
-          void *ptr = static_cast<void *>(head);
-          free_size_ -= size;
-          return GET_PTR(void, ptr, alignment_);
-        }
-      }
+    static void *operator new[](size_t sz) {
+      return (void *)malloc<computation_t>(sz);
+    }
 
-      // No cached memory
-      size_t len = size + alignment_;
-#if defined(WIN32)
-      ptr = _aligned_malloc(size, alignment_);
-#else
-      int rc = ::posix_memalign(&ptr, alignment_, len);
-      if (rc != 0)
-        throw std::invalid_argument("Out of memory");
-#endif
-      header_t *head = static_cast<header_t *>(ptr);
-      head->size_ = size;
-      head->seq_ = seq_++;
-      alloc_size_ += size;
-      return GET_PTR(void, ptr, alignment_);
+    static void operator delete(void *p) { free<computation_t>(p); }
+    static void operator delete[](void *p) {
+      free<computation_t>(p);
+    }
+
+  private:
+    char q;
+  };
+};
+
+/// Pools memory on the NUMA node of the allocating thread. Paired with
+/// numa::bind_omp_threads, activations produced and consumed by the same
+/// OpenMP layout stay node-local.
+class numa_allocator {
+public:
+  static slab_pool *get_pool(int node) {
+    static std::vector<std::unique_ptr<slab_pool>> pools_ = [] {
+      std::vector<std::unique_ptr<slab_pool>> pools;
+      int nodes = numa::num_nodes();
+      for (int node = 0; node < nodes; node ++)
+        pools.emplace_back(new slab_pool(nodes > 1 ? node : -1));
+      return pools;
+    }();
+    return pools_[node].get();
+  }
+
+  template<class computation_t = void>
+  static char *malloc(size_t size) {
+    return static_cast<char *>(
+        get_pool(numa::current_node())->malloc(size));
+  }
+
+  template<class computation_t = void>
+  static void free(void *p) {
+    slab_pool::of(p)->free(p);
+  }
+
+  template<class computation_t = void>
+  struct byte {
+  public:
+    static void *operator new(size_t sz) {
+      return (void *)malloc<computation_t>(sz);
     }
 
-    void free(void *ptr) {
-      std::lock_guard<std::mutex> lock(mutex_);
-      header_t *head = GET_PTR(header_t, ptr, -alignment_);
-      int idx = to_index(head->size_);
-      free_hashline_[idx].push_back(head);
-      free_size_ += head->size_;
+    static void *operator new[](size_t sz) {
+      return (void *)malloc<computation_t>(sz);
+    }
+
+    static void operator delete(void *p) { free<computation_t>(p); }
+    static void operator delete[](void *p) {
+      free<computation_t>(p);
     }
 
   private:
-    inline int to_index(size_t size) {
-      std::ostringstream os;
-      os << std::hex << "L" << size << "_";
-      size_t hash = std::hash<std::string>{}(os.str());
-      return hash % MAX_ENTRY;
-    }
-
-    typedef struct {
-      size_t size_;
-      int seq_;
-    } header_t;
-
-    static constexpr int MAX_ENTRY = 512;
-
-    size_t alloc_size_;
-    size_t free_size_;
-    const size_t alignment_;
-    std::list<header_t *> free_hashline_[MAX_ENTRY];
-    std::mutex mutex_;
-    int seq_;
+    char q;
   };
+};
 
-  scratch_allocator() = default;
+/// Interleaves pages across all NUMA nodes, for weights read by threads
+/// of every node.
+class interleave_allocator {
+public:
+  template<class computation_t = void>
+  static char *malloc(size_t size) {
+    auto ptr = allocator::malloc<computation_t>(size);
+    if (ptr != nullptr)
+      numa::set_policy(ptr, size, numa::interleave);
+    return ptr;
+  }
 
   template<class computation_t = void>
-  static inline mpool *get_mpool(void) {
-    static std::shared_ptr<mpool> mpool_(new mpool());
-    return mpool_.get();
+  static void free(void *p) {
+    allocator::free<computation_t>(p);
   }
 
+  template<class computation_t = void>
+  struct byte {
+  public:
+    static void *operator new(size_t sz) {
+      return (void *)malloc<computation_t>(sz);
+    }
+
+    static void *operator new[](size_t sz) {
+      return (void *)malloc<computation_t>(sz);
+    }
+
+    static void operator delete(void *p) { free<computation_t>(p); }
+    static void operator delete[](void *p) {
+      free<computation_t>(p);
+    }
+
+  private:
+    char q;
+  };
+};
+
+/// Maps buffers of at least huge_page::threshold() bytes on 2MB pages,
+/// whether or not huge pages are enabled globally, and allocates smaller
+/// ones as utils::allocator does.
+class huge_page_allocator {
+public:
   template<class computation_t = void>
   static char *malloc(size_t size) {
-    if (!is_enabled())
-      return static_cast<char *>(allocator::malloc(size));
-    else
-      return static_cast<char *>(get_mpool<computation_t>()->malloc(size));
+    const size_t offset = SYS_MEMORY_ALIGNMENT;
+    void *ptr = nullptr;
+    bool mapped = size >= huge_page::threshold().load();
+    if (mapped) {
+      ptr = huge_page::map(size, offset);
+      mapped = ptr != nullptr;
+      if (mapped)
+        ptr = GET_PTR(void, ptr, -offset);
+    }
+    if (!mapped) {
+      ptr = allocator::malloc<computation_t>(size + offset);
+      if (ptr == nullptr)
+        return nullptr;
+    }
+
+    auto head = static_cast<header_t *>(ptr);
+    head->size_ = size;
+    head->mapped_ = mapped;
+    return GET_PTR(char, ptr, offset);
   }
 
   template<class computation_t = void>
   static void free(void *p) {
-    if (!is_enabled())
-      allocator::free(p);
+    auto head = GET_PTR(header_t, p, -SYS_MEMORY_ALIGNMENT);
+    if (head->mapped_)
+      huge_page::unmap(p, head->size_, SYS_MEMORY_ALIGNMENT);
     else
-      get_mpool<computation_t>()->free(p);
+      allocator::free<computation_t>(head);
   }
 
   template<class computation_t = void>
@@ -233,6 +1095,12 @@ public:
   private:
     char q;
   };
+
+private:
+  struct header_t {
+    size_t size_;
+    bool mapped_;
+  };
 };
 }
 }
@@ -33,6 +33,7 @@
 #include <iterator>
 #include <string>
 #include <cstring>
+#include <cmath>
 #include <numeric>
 #include <functional>
 #include <iostream>
@@ -209,6 +210,42 @@ public:
       return ret;
     }
 
+    static void hash_to(utils::hasher &h, const_mkldnn_post_ops_t ops) {
+      auto len = mkldnn_post_ops_len(ops);
+      h.update(len);
+      for (int i = 0; i < len; i ++) {
+        auto akind = static_cast<kind>(mkldnn_post_ops_get_kind(ops, i));
+        mkldnn_alg_kind_t c_alg = mkldnn_eltwise_relu;
+        float scale = 1.0, alpha = 1.0, beta = 0.0;
+
+        switch(akind) {
+          case kind::sum:
+            error::wrap_c_api(
+                mkldnn_post_ops_get_params_sum(ops, i, &scale),
+                "could not get sum params");
+            utils::hash_to(h, akind);
+            utils::hash_to(h, scale);
+            break;
+          case kind::eltwise:
+            error::wrap_c_api(mkldnn_post_ops_get_params_eltwise(ops, i,
+                  &scale, &c_alg, &alpha, &beta),
+                "could not get eltwise params");
+            utils::hash_to(h, akind);
+            utils::hash_to(h, scale);
+            utils::hash_to(h, alpha);
+            utils::hash_to(h, beta);
+            utils::hash_to(h, c_alg);
+            break;
+          default:
+            break;
+        }
+      }
+    }
+
+    void hash_to(utils::hasher &h) const {
+      hash_to(h, get());
+    }
+
   public:
     // Helper factory
     static post_ops sum(float scale = 1.0) {
@@ -311,6 +348,67 @@ public:
       return bytes;
     }
 
+    // Same content as to_bytes, without materializing post_ops or scales
+    void hash_to(utils::hasher &h) const {
+      const_mkldnn_post_ops_t c_ops;
+      error::wrap_c_api(mkldnn_primitive_attr_get_post_ops(get(), &c_ops),
+          "could not get post operatoion sequence");
+      post_ops::hash_to(h, c_ops);
+
+      int count, c_mask;
+      const float *c_scales;
+      error::wrap_c_api(mkldnn_primitive_attr_get_output_scales(get(),
+            &count, &c_mask, &c_scales), "could not get int output scales");
+      h.update(count);
+      for (int i = 0; i < count; i ++)
+        utils::hash_to(h, c_scales[i]);
+      utils::hash_to(h, c_mask);
+    }
+
+    void serialize(utils::bytestring &bytes) const {
+      auto ops = get_post_ops();
+      utils::serialize(bytes, ops.num_ops());
+      for (int i = 0; i < ops.num_ops(); i ++) {
+        kind akind;
+        float scale, alpha, beta;
+        algorithm alg;
+        std::tie(akind, scale, alpha, beta, alg) = ops.get_params(i);
+        utils::serialize_args(bytes, akind, scale, alpha, beta, alg);
+      }
+
+      auto scales = get_output_scales();
+      utils::serialize_args(bytes, scales.first, scales.second,
+          get_int_output_round_mode());
+    }
+
+    void deserialize(utils::byte_reader &reader) {
+      int num_ops;
+      utils::deserialize(reader, num_ops);
+      post_ops ops;
+      for (int i = 0; i < num_ops; i ++) {
+        kind akind;
+        float scale, alpha, beta;
+        algorithm alg;
+        utils::deserialize(reader, akind);
+        utils::deserialize(reader, scale);
+        utils::deserialize(reader, alpha);
+        utils::deserialize(reader, beta);
+        utils::deserialize(reader, alg);
+        ops.append(akind, scale, alpha, beta, alg);
+      }
+      set_post_ops(ops);
+
+      scale_t scales;
+      int mask;
+      round_mode mode;
+      utils::deserialize(reader, scales);
+      utils::deserialize(reader, mask);
+      utils::deserialize(reader, mode);
+      if (!scales.empty())
+        set_output_scales(mask, scales);
+      set_int_output_round_mode(mode);
+    }
+
   public:
     // Helper factory
     //
@@ -679,6 +777,7 @@ protected:
 
     // Operator
     execution_sequence.push_back(get());
+    utils::computation_web::graph<tensor>::executed();
 
     __itt_frame_begin_v3(instruments::domain::ideep(), nullptr);
     error::wrap_c_api(
@@ -795,6 +894,7 @@ public:
 
     std::vector<mkldnn_primitive_t> execution_sequence = {get()};
     mkldnn_primitive_t c_api_error_primitive;
+    utils::computation_web::graph<tensor>::executed();
 
     __itt_frame_begin_v3(instruments::domain::ideep(), nullptr);
     error::wrap_c_api(
@@ -1174,10 +1274,15 @@ public:
       }
       comp.do_compute(inputs_in, output);
     } else {
+      // Accumulating into the first input. Its copy in inputs_in is taken
+      // before output gets bound, so the node reads the prior value. A
+      // convolution producing the second input may take the sum as a post
+      // op, which scales the accumulated dst only.
       sum comp(scales, inputs_desc, output.get_descriptor());
-      if (web_opt && !inplace) {
-        auto fattr = inputs_in.size() == 2 ?
-            fusion_attr_t{ fusion_type_t::CN_FUSION_SUM, {scales[0]}, {}  } :
+      if (web_opt) {
+        auto fattr = inputs_in.size() == 2 && scales[1] == 1.0f ?
+            fusion_attr_t{ fusion_type_t::CN_FUSION_SUM, {scales[0]},
+              {inputs_in[0]} } :
             fusion_attr_t{ fusion_type_t::CN_FUSION_NA, {}, {} };
 
         auto cn = utils::computation_web::template computation_node<
@@ -1196,6 +1301,12 @@ public:
       std::vector<tensor>& deps, std::vector<tensor>& tars) {
     do_compute(deps, tars[0]);
   }
+
+  // Accumulate into the first input when nothing else reads it, gradient
+  // sums then need no buffer of their own
+  virtual bool can_compute_inplace() const {
+    return expected_input_descriptor(0) == expected_dst_descriptor();
+  }
 };
 
 /// Convolution forward computation, this class represent a MKL-DNN
@@ -1237,12 +1348,12 @@ struct convolution_forward: public computation,
       mkldnn::memory::validate_dims(padding_l);
       mkldnn::memory::validate_dims(padding_r);
       mkldnn_convolution_desc_t data;
-      mkldnn_memory_desc_t src_data = src_desc.format_any();
+      mkldnn_memory_desc_t src_data = src_desc.format_activation();
       mkldnn_memory_desc_t weights_data = weights_desc.format_any();
       mkldnn_memory_desc_t bias_data = bias_desc.format_any();
       mkldnn_memory_desc_t dst_data =
         attr.get_post_ops().has_op_kind(kind::sum) ?
-        *dst_desc.get_mkldnn_memory_desc_t() : dst_desc.format_any();
+        *dst_desc.get_mkldnn_memory_desc_t() : dst_desc.format_activation();
       tensor::dims dilates_in {0, 0};
       if (!dilates.empty() && !IDEEP_STD_ANY_LE(dilates, 0)) {
         dilates_in = dilates;
@@ -1293,11 +1404,11 @@ struct convolution_forward: public computation,
       mkldnn::memory::validate_dims(padding_l);
       mkldnn::memory::validate_dims(padding_r);
       mkldnn_convolution_desc_t data;
-      mkldnn_memory_desc_t src_data = src_desc.format_any();
+      mkldnn_memory_desc_t src_data = src_desc.format_activation();
       mkldnn_memory_desc_t weights_data = weights_desc.format_any();
       mkldnn_memory_desc_t dst_data =
         attr.get_post_ops().has_op_kind(kind::sum) ?
-        *dst_desc.get_mkldnn_memory_desc_t() : dst_desc.format_any();
+        *dst_desc.get_mkldnn_memory_desc_t() : dst_desc.format_activation();
       tensor::dims dilates_in {0, 0};
       if (!dilates.empty() && !IDEEP_STD_ANY_LE(dilates, 0)) {
         dilates_in = dilates;
@@ -1466,23 +1577,29 @@ struct convolution_forward: public computation,
       padding_kind appading_kind) {
     auto conv_fuse = [src, weights, bias, dst_dims, strides, dilates,
         padding_l, padding_r, aalgorithm, aprop_kind, appading_kind] (
-        tensor& dst, descriptor::attr_t _attr) -> cn_t {
+        tensor& dst, descriptor::attr_t _attr,
+        const std::vector<tensor>& extra_deps) -> cn_t {
+      // Only deferred, so never from a shared cache, see deferrable()
+      iterator it;
       tensor _weights, src_in, weights_in;
       auto fused_comp = convolution_forward::create_computation<alloc,
-          web_opt>(src, weights, bias, dst_dims, dst, _weights,
+          web_opt>(it, src, weights, bias, dst_dims, dst, _weights,
           src_in, weights_in, strides, dilates, padding_l, padding_r,
           _attr, aalgorithm, aprop_kind, appading_kind);
+      // The post ops of a fused computation do not compose with another
+      fused_comp.post_ops_fused_ = true;
       auto fused_cn = utils::computation_web::template computation_node<
           convolution_forward, tensor>::create(
-          fused_comp, prop_kind_t::CN_PROP_FORWARD, dst);
-      if (fused_cn->build_deps(src, _weights, bias, src_in, weights_in))
+          fused_comp, prop_kind_t::CN_PROP_FORWARD, conv_fusion_attr(), dst);
+      if (fused_cn->build_deps(src, _weights, bias, src_in, weights_in) &&
+          fused_cn->build_deps(extra_deps))
         return fused_cn;
       else
         return nullptr;
     };
 
-    conv_fuse_ = std::make_shared<std::function<
-        cn_t(tensor&, descriptor::attr_t)>>(conv_fuse);
+    conv_fuse_ = std::make_shared<std::function<cn_t(tensor&,
+        descriptor::attr_t, const std::vector<tensor>&)>>(conv_fuse);
   }
 
   template<class alloc, bool web_opt>
@@ -1535,7 +1652,7 @@ struct convolution_forward: public computation,
           padding_l, padding_r, aalgorithm, aprop_kind, appading_kind);
       auto fused_cn = utils::computation_web::template computation_node<
           convolution_forward, tensor>::create(
-          pre_comp, prop_kind_t::CN_PROP_FORWARD, dst);
+          pre_comp, prop_kind_t::CN_PROP_FORWARD, conv_fusion_attr(), dst);
       if (fused_cn->build_deps(src, folded_w, folded_b, src_in, weights_in))
         return fused_cn;
       else
@@ -1547,9 +1664,143 @@ struct convolution_forward: public computation,
         tensor&, std::vector<tensor>&, float)>>(conv_bn_folding);
   }
 
+  /// With autotuning on (see utils::tuning_table), the fastest of direct
+  /// and winograd for this shape, measured on scratch data the first time
+  /// the shape is seen. Algorithms other than direct are left to the
+  /// caller, so is everything when tuning is off.
+  static algorithm tuned_algorithm(const tensor::descriptor& src_desc,
+      const tensor::descriptor& weights_desc,
+      const tensor::descriptor *bias_desc,
+      const tensor::descriptor& dst_desc,
+      const tensor::dims& strides, const tensor::dims& dilates,
+      const tensor::dims& padding_l, const tensor::dims& padding_r,
+      const descriptor::attr_t& attr, algorithm aalgorithm,
+      prop_kind aprop_kind, padding_kind appading_kind) {
+    if (!utils::tuning_table::is_enabled() ||
+        aalgorithm != algorithm::convolution_direct ||
+        src_desc.get_data_type() != tensor::data_type::f32)
+      return aalgorithm;
+
+    auto key = utils::create_key(src_desc.get_dims(),
+        weights_desc.get_dims(), static_cast<int>(bias_desc != nullptr),
+        dst_desc.get_dims(), static_cast<int>(engine::channels_last()),
+        strides, dilates, padding_l, padding_r, attr, aprop_kind,
+        appading_kind);
+    int choice;
+    if (utils::tuning_table::find(key, choice))
+      return static_cast<algorithm>(choice);
+
+    auto best = aalgorithm;
+    auto best_ns = std::numeric_limits<int64_t>::max();
+    for (auto alg : {algorithm::convolution_direct,
+        algorithm::convolution_winograd}) {
+      convolution_forward comp;
+      try {
+        if (bias_desc != nullptr)
+          comp.init(src_desc, weights_desc, *bias_desc, dst_desc, strides,
+              dilates, padding_l, padding_r, attr, alg, aprop_kind,
+              appading_kind);
+        else
+          comp.init(src_desc, weights_desc, dst_desc, strides, dilates,
+              padding_l, padding_r, attr, alg, aprop_kind, appading_kind);
+      } catch (const error&) {
+        // Not implemented for this shape or CPU
+        continue;
+      }
+
+      tensor src, weights, bias, dst;
+      src.init(comp.expected_src_descriptor());
+      weights.init(comp.expected_weights_descriptor());
+      dst.init(comp.expected_dst_descriptor());
+      for (auto t : {&src, &weights, &dst})
+        utils::fast_memset(static_cast<float *>(t->get_data_handle()),
+            0.f, t->get_nelems());
+      if (bias_desc != nullptr) {
+        bias.init(comp.expected_bias_descriptor());
+        utils::fast_memset(static_cast<float *>(bias.get_data_handle()),
+            0.f, bias.get_nelems());
+      }
+
+      // First run warms caches up, keep the best of the following
+      auto ns = std::numeric_limits<int64_t>::max();
+      for (int i = 0; i < 4; i++) {
+        auto start = std::chrono::steady_clock::now();
+        if (bias_desc != nullptr)
+          comp.execute(src, weights, bias, dst);
+        else
+          comp.execute(src, weights, dst);
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        if (i > 0)
+          ns = std::min<int64_t>(ns, elapsed);
+      }
+
+      if (ns < best_ns) {
+        best_ns = ns;
+        best = alg;
+      }
+    }
+
+    utils::tuning_table::insert(key, static_cast<int>(best));
+    return best;
+  }
+
+  // A convolution summing into dst accumulates in the format dst has,
+  // otherwise it picks its own
+  static tensor::descriptor result_descriptor(const tensor& src,
+      const tensor::dims& dst_dims, const tensor& dst,
+      const descriptor::attr_t& attr) {
+    if (!attr.get_post_ops().has_op_kind(kind::sum))
+      return {dst_dims, src.get_data_type()};
+    return {dst_dims, src.get_data_type(), dst.get_internal_format()};
+  }
+
+  // Keyed by the algorithm asked for, tuned only when created. Every path
+  // to a forward convolution comes through here, so weights packed ahead
+  // of time match what compute picks.
+  static void checkout(iterator& it, const tensor::descriptor& src_desc,
+      const tensor::descriptor& weights_desc,
+      const tensor::descriptor *bias_desc,
+      const tensor::descriptor& result_desc,
+      const tensor::dims& strides, const tensor::dims& dilates,
+      const tensor::dims& padding_l, const tensor::dims& padding_r,
+      const descriptor::attr_t& attr, algorithm aalgorithm,
+      prop_kind aprop_kind, padding_kind appading_kind) {
+    auto key = bias_desc != nullptr ?
+      utils::create_key(src_desc.get_data_type(), src_desc.get_dims(),
+          weights_desc.get_dims(), bias_desc->get_dims(),
+          result_desc.get_dims(), result_desc.get_internal_format(),
+          static_cast<int>(engine::channels_last()), strides, dilates,
+          padding_l, padding_r, attr, aalgorithm, aprop_kind, appading_kind) :
+      utils::create_key(src_desc.get_data_type(), src_desc.get_dims(),
+          weights_desc.get_dims(), result_desc.get_dims(),
+          result_desc.get_internal_format(),
+          static_cast<int>(engine::channels_last()), strides, dilates,
+          padding_l, padding_r, attr, aalgorithm, aprop_kind, appading_kind);
+
+    it = find(key);
+    if (it != end())
+      return;
+
+    auto alg = tuned_algorithm(src_desc, weights_desc, bias_desc,
+        result_desc, strides, dilates, padding_l, padding_r, attr,
+        aalgorithm, aprop_kind, appading_kind);
+    if (bias_desc != nullptr)
+      it = create(key, src_desc, weights_desc, *bias_desc, result_desc,
+          strides, dilates, padding_l, padding_r, attr, alg, aprop_kind,
+          appading_kind);
+    else
+      it = create(key, src_desc, weights_desc, result_desc, strides,
+          dilates, padding_l, padding_r, attr, alg, aprop_kind,
+          appading_kind);
+  }
+
+  // Checked out into it, which has to outlive any use of the returned
+  // copy, a shared cache hands the instance to another thread otherwise
   template<class alloc, bool web_opt>
-  static convolution_forward create_computation(const tensor& src,
-      const tensor& weights, const tensor::dims& dst_dims, tensor& dst,
+  static convolution_forward create_computation(iterator& it,
+      const tensor& src, const tensor& weights,
+      const tensor::dims& dst_dims, tensor& dst,
       tensor& _weights, tensor& src_in, tensor& weights_in,
       const tensor::dims& strides, const tensor::dims& dilates,
       const tensor::dims& padding_l, const tensor::dims& padding_r,
@@ -1557,31 +1808,19 @@ struct convolution_forward: public computation,
       algorithm aalgorithm = algorithm::convolution_direct,
       prop_kind aprop_kind = prop_kind::forward,
       padding_kind appading_kind = padding_kind::zero) {
-    convolution_forward comp;
-    tensor::descriptor result_desc(dst_dims, src.get_data_type());
+    auto result_desc = result_descriptor(src, dst_dims, dst, attr);
     if (web_opt) {
       tensor::dims bias_dims = {weights.get_dims()[0]};
       tensor::descriptor bias_desc = {bias_dims, weights.get_data_type()};
-      auto key = utils::create_key(src.get_data_type(), src.get_dims(),
-          weights.get_dims(), bias_dims, dst_dims, strides, dilates, padding_l,
-          padding_r, attr, aalgorithm, aprop_kind, appading_kind);
-
-      fetch_or_create_m(_comp, key, src.get_descriptor(),
-          weights.get_descriptor(), bias_desc, result_desc, strides,
-          dilates, padding_l, padding_r, attr, aalgorithm,
-          aprop_kind, appading_kind);
-      comp = _comp;
+      checkout(it, src.get_descriptor(), weights.get_descriptor(),
+          &bias_desc, result_desc, strides, dilates, padding_l, padding_r,
+          attr, aalgorithm, aprop_kind, appading_kind);
     } else {
-      auto key = utils::create_key(src.get_data_type(), src.get_dims(),
-          weights.get_dims(), dst_dims, strides, dilates, padding_l,
-          padding_r, attr, aalgorithm, aprop_kind, appading_kind);
-
-      fetch_or_create_m(_comp, key, src.get_descriptor(),
-          weights.get_descriptor(), result_desc, strides,
-          dilates, padding_l, padding_r, attr, aalgorithm,
-          aprop_kind, appading_kind);
-      comp = _comp;
+      checkout(it, src.get_descriptor(), weights.get_descriptor(), nullptr,
+          result_desc, strides, dilates, padding_l, padding_r, attr,
+          aalgorithm, aprop_kind, appading_kind);
     }
+    auto comp = fetch(it);
 
     src_in = src;
     if (src.get_descriptor() != comp.expected_src_descriptor())
@@ -1612,24 +1851,22 @@ struct convolution_forward: public computation,
   }
 
   template<class alloc, bool web_opt>
-  static convolution_forward create_computation(const tensor& src,
-      const tensor& weights, const tensor& bias, const tensor::dims& dst_dims,
-      tensor& dst, tensor& _weights, tensor& src_in, tensor& weights_in,
+  static convolution_forward create_computation(iterator& it,
+      const tensor& src, const tensor& weights, const tensor& bias,
+      const tensor::dims& dst_dims, tensor& dst, tensor& _weights,
+      tensor& src_in, tensor& weights_in,
       const tensor::dims& strides, const tensor::dims& dilates,
       const tensor::dims& padding_l, const tensor::dims& padding_r,
       const descriptor::attr_t& attr,
       algorithm aalgorithm = algorithm::convolution_direct,
       prop_kind aprop_kind = prop_kind::forward,
       padding_kind appading_kind = padding_kind::zero) {
-    tensor::descriptor result_desc(dst_dims, src.get_data_type());
-    auto key = utils::create_key(src.get_data_type(), src.get_dims(),
-        weights.get_dims(), bias.get_dims(), dst_dims, strides, dilates,
-        padding_l, padding_r, attr, aalgorithm, aprop_kind, appading_kind);
-
-    fetch_or_create_m(comp, key, src.get_descriptor(),
-        weights.get_descriptor(), bias.get_descriptor(), result_desc,
-        strides, dilates, padding_l, padding_r, attr, aalgorithm,
-        aprop_kind, appading_kind);
+    auto result_desc = result_descriptor(src, dst_dims, dst, attr);
+    auto bias_desc = bias.get_descriptor();
+    checkout(it, src.get_descriptor(), weights.get_descriptor(), &bias_desc,
+        result_desc, strides, dilates, padding_l, padding_r, attr,
+        aalgorithm, aprop_kind, appading_kind);
+    auto comp = fetch(it);
 
     src_in = src;
     if (src.get_descriptor() != comp.expected_src_descriptor())
@@ -1685,14 +1922,16 @@ struct convolution_forward: public computation,
   static void compute_impl(const tensor& src,
       const tensor& weights, const tensor::dims& dst_dims,
       tensor& dst, Ts&&... args) {
+    iterator it;
     tensor _weights, src_in, weights_in;
     auto comp = convolution_forward::create_computation<alloc, web_opt>(
-        src, weights, dst_dims, dst, _weights, src_in, weights_in, args...);
+        it, src, weights, dst_dims, dst, _weights, src_in, weights_in,
+        args...);
 
     if (web_opt) {
       auto cn = utils::computation_web::template computation_node<
           convolution_forward, tensor>::create(
-          comp, prop_kind_t::CN_PROP_FORWARD, dst);
+          comp, prop_kind_t::CN_PROP_FORWARD, conv_fusion_attr(), dst);
       if (cn->build_deps(src, _weights, comp.zero_bias(), src_in, weights_in)) {
         utils::computation_web::template computation_node<
             convolution_forward, tensor>::enqueue(cn);
@@ -1712,15 +1951,16 @@ struct convolution_forward: public computation,
   static void compute_impl(const tensor& src,
       const tensor& weights, const tensor& bias,
       const tensor::dims& dst_dims, tensor& dst, Ts&&... args) {
+    iterator it;
     tensor _weights, src_in, weights_in;
     auto comp = convolution_forward::create_computation<alloc, web_opt>(
-        src, weights, bias, dst_dims, dst,
+        it, src, weights, bias, dst_dims, dst,
         _weights, src_in, weights_in, args...);
 
     if (web_opt) {
       auto cn = utils::computation_web::template computation_node<
           convolution_forward, tensor>::create(
-          comp, prop_kind_t::CN_PROP_FORWARD, dst);
+          comp, prop_kind_t::CN_PROP_FORWARD, conv_fusion_attr(), dst);
       if (cn->build_deps(src, _weights, bias, src_in, weights_in)) {
         utils::computation_web::template computation_node<
             convolution_forward, tensor>::enqueue(cn);
@@ -1761,6 +2001,66 @@ struct convolution_forward: public computation,
         attr, aalgorithm, aprop_kind, appading_kind);
   }
 
+  /// Convolution with its epilogue fused, one pass over dst. The post ops
+  /// run in order after bias, e.g. post_ops::residual for a scaled sum
+  /// into dst followed by relu. eltwise ops with alpha give leaky relu,
+  /// algorithm::eltwise_bounded_relu clips at alpha. With a sum, dst holds
+  /// the residual: it is accumulated into in place, in its own format, when
+  /// it owns its buffer, otherwise dst is pointed at a plain copy first.
+  template<class alloc = utils::allocator>
+  static void compute(const tensor& src, const tensor& weights,
+      const tensor& bias, const tensor::dims& result_dims, tensor& dst,
+      const tensor::dims& strides, const tensor::dims& dilates,
+      const tensor::dims& padding_l, const tensor::dims& padding_r,
+      const descriptor::post_ops& epilogue,
+      algorithm aalgorithm = algorithm::convolution_direct,
+      prop_kind aprop_kind = prop_kind::forward,
+      padding_kind appading_kind = padding_kind::zero) {
+    prepare_residual<alloc>(src, result_dims, dst, epilogue);
+    compute_impl<alloc, false>(src, weights, bias, result_dims, dst,
+        strides, dilates, padding_l, padding_r,
+        descriptor::attr_t::attr_post_ops(epilogue),
+        aalgorithm, aprop_kind, appading_kind);
+  }
+
+  template<class alloc = utils::allocator>
+  static void compute(const tensor& src, const tensor& weights,
+      const tensor::dims& result_dims, tensor& dst,
+      const tensor::dims& strides, const tensor::dims& dilates,
+      const tensor::dims& padding_l, const tensor::dims& padding_r,
+      const descriptor::post_ops& epilogue,
+      algorithm aalgorithm = algorithm::convolution_direct,
+      prop_kind aprop_kind = prop_kind::forward,
+      padding_kind appading_kind = padding_kind::zero) {
+    prepare_residual<alloc>(src, result_dims, dst, epilogue);
+    compute_impl<alloc, false>(src, weights, result_dims, dst,
+        strides, dilates, padding_l, padding_r,
+        descriptor::attr_t::attr_post_ops(epilogue),
+        aalgorithm, aprop_kind, appading_kind);
+  }
+
+  // A convolution summing into dst is created with the format of dst, and
+  // dst must not be reallocated before it runs. A residual of another data
+  // type, or not owning its buffer, is copied to the default format first.
+  template<class alloc>
+  static void prepare_residual(const tensor& src,
+      const tensor::dims& result_dims, tensor& dst,
+      const descriptor::post_ops& epilogue) {
+    if (!epilogue.has_op_kind(kind::sum))
+      return;
+
+    IDEEP_ENFORCE(dst.get_dims() == result_dims,
+        "Unmatch dims of residual and convolution output");
+    tensor::descriptor result_desc(result_dims, src.get_data_type());
+    if (dst.get_data_type() != src.get_data_type() ||
+        dst.get_tensor_buffer().get() != dst.get_data_handle()) {
+      tensor residual;
+      residual.init<alloc, convolution_forward>(result_desc);
+      reorder::compute(dst, residual);
+      dst = residual;
+    }
+  }
+
   template <class alloc, bool with_bias>
   static void compute_impl(convolution_forward &comp, const tensor& src,
       const tensor& weights, const tensor& bias, tensor& dst) {
@@ -1901,12 +2201,14 @@ struct convolution_forward: public computation,
       key = with_bias
         ? utils::create_key(
             src.get_data_type(), src.get_dims(), src.get_internal_format(),
+            static_cast<int>(engine::channels_last()),
             weights.get_data_type(), weights.get_dims(),
             weights.get_internal_format(), bias.get_dims(),
             strides, dilates, padding_l, padding_r, op_attr,
             src_scales, dst_scales, args...)
         : utils::create_key(
             src.get_data_type(), src.get_dims(), src.get_internal_format(),
+            static_cast<int>(engine::channels_last()),
             weights.get_data_type(), weights.get_dims(),
             weights.get_internal_format(),
             strides, dilates, padding_l, padding_r, op_attr,
@@ -2012,10 +2314,13 @@ struct convolution_forward: public computation,
       apkind = prop_kind::forward;
     }
 
+    // A replayed computation (see cache_manifest) has not been through
+    // the full path yet
     auto it = key.empty() ? end() : find(key);
-    if (it != end()) {
+    if (it != end() && fetch(it).src_in_) {
       compute_impl<alloc, false>(fetch(it), src, weights_in, dummy_bias, dst);
     } else {
+      it = end();
       compute_impl<alloc, false>(
           key, src, weights_in, dummy_bias, result_dims, dst,
           strides, dilates, padding_l, padding_r,
@@ -2046,10 +2351,13 @@ struct convolution_forward: public computation,
       apkind = prop_kind::forward;
     }
 
+    // A replayed computation (see cache_manifest) has not been through
+    // the full path yet
     auto it = key.empty() ? end() : find(key);
-    if (it != end()) {
+    if (it != end() && fetch(it).src_in_) {
       compute_impl<alloc, true>(fetch(it), src, weights_in, bias, dst);
     } else {
+      it = end();
       compute_impl<alloc, true>(
           key, src, weights_in, bias, result_dims, dst,
           strides, dilates, padding_l, padding_r,
@@ -2126,7 +2434,8 @@ struct convolution_forward: public computation,
 
   virtual void fire_computation_node(
       std::vector<tensor>& deps, std::vector<tensor>& tars) {
-    if (deps.size() == 5)
+    // Deps past the fifth only order a fused node after their producers
+    if (deps.size() >= 5)
       do_compute(deps[0], deps[1], deps[2], deps[3], deps[4], tars[0]);
     else if (deps.size() == 4)
       do_compute(deps[0], deps[1], deps[2], deps[3], tars[0]);
@@ -2135,25 +2444,183 @@ struct convolution_forward: public computation,
   virtual cn_t fuse_if_necessary(
       std::shared_ptr<utils::computation_web::template node<tensor>> pre_comp,
       fusion_attr_t& tar_attr, tensor& dst) {
+    if (!conv_fuse_ || !conv_bn_folding_ || post_ops_fused_)
+      return nullptr;
+
     auto conv_fuse = *conv_fuse_.get();
     auto conv_bn_folding = *conv_bn_folding_.get();
     switch (tar_attr.ftype) {
     case fusion_type_t::CN_FUSION_RELU:
       return conv_fuse(dst, descriptor_group::attr_t::fuse_relu(
-          1.0, tar_attr.fattrs[0], tar_attr.fattrs[1]));
+          1.0, tar_attr.fattrs[0], tar_attr.fattrs[1]), {});
     case fusion_type_t::CN_FUSION_SUM:
-      // skip if src0(dst) is not materialized
-      if (!dst.is_materialized())
+      // skip if dst would be reallocated instead of accumulated into. Its
+      // prior value stays a dependency of the fused node.
+      if (dst.get_descriptor() != expected_dst_descriptor())
         return nullptr;
       return conv_fuse(dst,
-          descriptor_group::attr_t::fuse_sum(tar_attr.fattrs[0]));
+          descriptor_group::attr_t::fuse_sum(tar_attr.fattrs[0]),
+          tar_attr.deps);
     case fusion_type_t::CN_FUSION_BN:
+      // folding reads the statistics now
+      for (auto& dep : tar_attr.deps)
+        if (!dep.is_materialized())
+          return nullptr;
       return conv_bn_folding(pre_comp, dst, tar_attr.deps, tar_attr.fattrs[0]);
     default:
       return nullptr;
     }
   }
 
+  /// Reorder weights once into the format the convolution of src_dims
+  /// expects. Weights packed this way are used as they are by compute,
+  /// so inference with frozen weights never reorders them again.
+  template<class alloc = utils::allocator>
+  static tensor prepack_weights(const tensor::dims& src_dims,
+      const tensor& weights, const tensor::dims& dst_dims,
+      const tensor::dims& strides, const tensor::dims& dilates,
+      const tensor::dims& padding_l, const tensor::dims& padding_r,
+      int group = 1, const descriptor::attr_t& attr = descriptor::attr_t(),
+      algorithm aalgorithm = algorithm::convolution_direct,
+      prop_kind aprop_kind = prop_kind::forward,
+      padding_kind appading_kind = padding_kind::zero) {
+    IDEEP_ENFORCE(!weights.has_scale()
+        && weights.get_data_type() == tensor::data_type::f32,
+          "INT8 mode is not supported");
+    auto _weights = weights;
+    _weights.make_group(group);
+    return prepack_weights_impl<alloc>(src_dims, _weights.as_weights(),
+        nullptr, dst_dims, strides, dilates, padding_l, padding_r, attr,
+        aalgorithm, aprop_kind, appading_kind);
+  }
+
+  // Packed for the computation compute creates for these weights, with a
+  // bias when bias_desc is given
+  template<class alloc>
+  static tensor prepack_weights_impl(const tensor::dims& src_dims,
+      const tensor& weights, const tensor::descriptor *bias_desc,
+      const tensor::dims& dst_dims,
+      const tensor::dims& strides, const tensor::dims& dilates,
+      const tensor::dims& padding_l, const tensor::dims& padding_r,
+      const descriptor::attr_t& attr, algorithm aalgorithm,
+      prop_kind aprop_kind, padding_kind appading_kind) {
+    tensor::descriptor src_desc(src_dims, weights.get_data_type());
+    tensor::descriptor result_desc(dst_dims, weights.get_data_type());
+    iterator it;
+    checkout(it, src_desc, weights.get_descriptor(), bias_desc, result_desc,
+        strides, dilates, padding_l, padding_r, attr, aalgorithm, aprop_kind,
+        appading_kind);
+    auto comp = fetch(it);
+
+    if (weights.get_descriptor() == comp.expected_weights_descriptor())
+      return weights;
+
+    tensor packed;
+    packed.init<alloc, convolution_forward>(
+        comp.expected_weights_descriptor());
+    reorder::compute(weights, packed);
+    return packed;
+  }
+
+  /// Fold the batch normalization that follows a convolution into its
+  /// weights and bias once, at model load time:
+  ///   weights' = weights * scale / sqrt(var + eps)
+  ///   bias' = (bias - mean) * scale / sqrt(var + eps) + shift
+  /// Returns {weights', bias'}, weights' prepacked like prepack_weights,
+  /// so the inference graph runs a plain convolution without the BN op.
+  template<class alloc = utils::allocator>
+  static std::vector<tensor> fold_batch_normalization(
+      const tensor::dims& src_dims, const tensor& weights, const tensor& bias,
+      const tensor& mean, const tensor& variance, const tensor& scale,
+      const tensor& shift, float epsilon, const tensor::dims& dst_dims,
+      const tensor::dims& strides, const tensor::dims& dilates,
+      const tensor::dims& padding_l, const tensor::dims& padding_r,
+      int group = 1, algorithm aalgorithm = algorithm::convolution_direct,
+      prop_kind aprop_kind = prop_kind::forward,
+      padding_kind appading_kind = padding_kind::zero) {
+    return fold_batch_normalization_impl<alloc>(src_dims, weights, &bias,
+        {mean, variance, scale, shift}, epsilon, dst_dims, strides, dilates,
+        padding_l, padding_r, group, aalgorithm, aprop_kind, appading_kind);
+  }
+
+  template<class alloc = utils::allocator>
+  static std::vector<tensor> fold_batch_normalization(
+      const tensor::dims& src_dims, const tensor& weights,
+      const tensor& mean, const tensor& variance, const tensor& scale,
+      const tensor& shift, float epsilon, const tensor::dims& dst_dims,
+      const tensor::dims& strides, const tensor::dims& dilates,
+      const tensor::dims& padding_l, const tensor::dims& padding_r,
+      int group = 1, algorithm aalgorithm = algorithm::convolution_direct,
+      prop_kind aprop_kind = prop_kind::forward,
+      padding_kind appading_kind = padding_kind::zero) {
+    return fold_batch_normalization_impl<alloc>(src_dims, weights, nullptr,
+        {mean, variance, scale, shift}, epsilon, dst_dims, strides, dilates,
+        padding_l, padding_r, group, aalgorithm, aprop_kind, appading_kind);
+  }
+
+  template<class alloc>
+  static std::vector<tensor> fold_batch_normalization_impl(
+      const tensor::dims& src_dims, const tensor& weights, const tensor *bias,
+      const std::vector<tensor>& bn_attrs, float epsilon,
+      const tensor::dims& dst_dims,
+      const tensor::dims& strides, const tensor::dims& dilates,
+      const tensor::dims& padding_l, const tensor::dims& padding_r,
+      int group, algorithm aalgorithm, prop_kind aprop_kind,
+      padding_kind appading_kind) {
+    IDEEP_ENFORCE(weights.get_data_type() == tensor::data_type::f32
+        && !weights.has_scale(), "INT8 mode is not supported");
+    for (auto& attr : bn_attrs)
+      IDEEP_ENFORCE(attr.get_data_type() == tensor::data_type::f32,
+          "Incorrect data type in batch normalization statistics");
+
+    // Plain (g)oihw, output channels are then consecutive blocks
+    auto _weights = weights;
+    _weights.make_group(group);
+    tensor folded_w;
+    folded_w.init<alloc, convolution_forward>(
+        {_weights.get_dims(), tensor::data_type::f32,
+        IDEEP_IS_GROUPED_4DIMS(_weights.get_dims()) ?
+        format::goihw : format::oihw});
+    reorder::compute(_weights, folded_w);
+
+    auto oc = bn_attrs[0].get_nelems();
+    auto w_dims = folded_w.get_dims();
+    auto w_oc = IDEEP_IS_GROUPED_4DIMS(w_dims) ?
+        w_dims[0] * w_dims[1] : w_dims[0];
+    IDEEP_ENFORCE(w_oc == oc,
+        "Unmatch output channels of weights and batch normalization");
+    auto blk = folded_w.get_nelems() / oc;
+
+    tensor folded_b;
+    folded_b.init<alloc, convolution_forward>(
+        {{static_cast<int>(oc)}, tensor::data_type::f32, format::x});
+
+    auto mean = static_cast<const float *>(bn_attrs[0].get_data_handle());
+    auto var = static_cast<const float *>(bn_attrs[1].get_data_handle());
+    auto gamma = static_cast<const float *>(bn_attrs[2].get_data_handle());
+    auto beta = static_cast<const float *>(bn_attrs[3].get_data_handle());
+    auto b = bias != nullptr ?
+        static_cast<const float *>(bias->get_data_handle()) : nullptr;
+    auto w_base = static_cast<float *>(folded_w.get_data_handle());
+    auto b_base = static_cast<float *>(folded_b.get_data_handle());
+
+    # pragma omp parallel for schedule(static)
+    for (ssize_t o = 0; o < (ssize_t)oc; o++) {
+      float factor = gamma[o] / std::sqrt(var[o] + epsilon);
+      for (size_t i = 0; i < blk; i++)
+        w_base[o * blk + i] *= factor;
+      b_base[o] = ((b != nullptr ? b[o] : 0.f) - mean[o]) * factor + beta[o];
+    }
+
+    // Run with the folded bias, so packed for the convolution with one
+    auto bias_desc = folded_b.get_descriptor();
+    auto packed_w = prepack_weights_impl<alloc>(src_dims,
+        folded_w.as_weights(), &bias_desc, dst_dims,
+        strides, dilates, padding_l, padding_r, descriptor::attr_t(),
+        aalgorithm, aprop_kind, appading_kind);
+    return {packed_w, folded_b};
+  }
+
   static tensor::descriptor expected_weights_descriptor(
       const tensor::dims& weights_dims,
       tensor::data_type dtype = tensor::data_type::f32,
@@ -2235,11 +2702,16 @@ private:
   std::shared_ptr<tensor::descriptor> dst_exp_desc_;
   std::shared_ptr<tensor::descriptor> dst_u8_desc_;
   std::shared_ptr<scale_t> dst_scales_;
-  std::shared_ptr<std::function<
-      cn_t(tensor&, descriptor::attr_t)>> conv_fuse_;
+  std::shared_ptr<std::function<cn_t(tensor&, descriptor::attr_t,
+      const std::vector<tensor>&)>> conv_fuse_;
   std::shared_ptr<std::function<
       cn_t(std::shared_ptr<utils::computation_web::node<tensor>>,
       tensor&, std::vector<tensor>&, float)>> conv_bn_folding_;
+  bool post_ops_fused_ = false;
+
+  static fusion_attr_t conv_fusion_attr() {
+    return fusion_attr_t{ fusion_type_t::CN_FUSION_CONV, {}, {} };
+  }
 };
 
 struct convolution_backward_data : public computation,
@@ -2262,9 +2734,9 @@ struct convolution_backward_data : public computation,
       mkldnn::memory::validate_dims(padding_l);
       mkldnn::memory::validate_dims(padding_r);
       mkldnn_convolution_desc_t data;
-      mkldnn_memory_desc_t diff_src_any = gradx_desc.format_any();
+      mkldnn_memory_desc_t diff_src_any = gradx_desc.format_activation();
       mkldnn_memory_desc_t weights_any = weights_desc.format_any();
-      mkldnn_memory_desc_t diff_dst_any = grady_desc.format_any();
+      mkldnn_memory_desc_t diff_dst_any = grady_desc.format_activation();
       tensor::dims dilates_in {0, 0};
       if (!dilates.empty() && !IDEEP_STD_ANY_LE(dilates, 0)) {
         dilates_in = dilates;
@@ -2329,7 +2801,8 @@ public:
       const tensor::dims& gradx_dims, tensor& gradx, Ts&&... args) {
     tensor::descriptor result_desc(gradx_dims, grady.get_data_type());
     auto key = utils::create_key(grady.get_data_type(), grady.get_dims(),
-        weights.get_dims(), gradx_dims, args...);
+        weights.get_dims(), gradx_dims,
+        static_cast<int>(engine::channels_last()), args...);
 
     fetch_or_create_m(comp, key, grady.get_descriptor(),
         weights.get_descriptor(), result_desc, std::forward<Ts>(args)...);
@@ -2414,10 +2887,10 @@ struct convolution_backward_weights : public computation,
       mkldnn::memory::validate_dims(padding_l);
       mkldnn::memory::validate_dims(padding_r);
       mkldnn_convolution_desc_t data;
-      mkldnn_memory_desc_t src_any = x_desc.format_any();
+      mkldnn_memory_desc_t src_any = x_desc.format_activation();
       mkldnn_memory_desc_t diff_weights_any = gradw_desc.format_any();
       mkldnn_memory_desc_t diff_bias_any = gradb_desc.format_any();
-      mkldnn_memory_desc_t diff_dst_any = grady_desc.format_any();
+      mkldnn_memory_desc_t diff_dst_any = grady_desc.format_activation();
       tensor::dims dilates_in {0, 0};
       if (!dilates.empty() && !IDEEP_STD_ANY_LE(dilates, 0)) {
         dilates_in = dilates;
@@ -2453,9 +2926,9 @@ struct convolution_backward_weights : public computation,
       mkldnn::memory::validate_dims(padding_l);
       mkldnn::memory::validate_dims(padding_r);
       mkldnn_convolution_desc_t data;
-      mkldnn_memory_desc_t src_any = x_desc.format_any();
+      mkldnn_memory_desc_t src_any = x_desc.format_activation();
       mkldnn_memory_desc_t diff_weights_any = gradw_desc.format_any();
-      mkldnn_memory_desc_t diff_dst_any = grady_desc.format_any();
+      mkldnn_memory_desc_t diff_dst_any = grady_desc.format_activation();
       tensor::dims dilates_in {0, 0};
       if (!dilates.empty() && !IDEEP_STD_ANY_LE(dilates, 0)) {
         dilates_in = dilates;
@@ -2528,7 +3001,8 @@ public:
         tensor::dims {grady.get_dim(1)}, src.get_data_type());
 
     auto key = utils::create_key(src.get_data_type(), src.get_dims(),
-        grady.get_dims(), gradw_dims, grady.get_dim(1), args...);
+        grady.get_dims(), gradw_dims, grady.get_dim(1),
+        static_cast<int>(engine::channels_last()), args...);
 
     fetch_or_create_m(comp, key, src.get_descriptor(),
         grady.get_descriptor(), gradw_desc, gradb_desc,
@@ -2580,7 +3054,8 @@ public:
     tensor::descriptor gradw_desc(gradw_dims, src.get_data_type());
 
     auto key = utils::create_key(src.get_data_type(), src.get_dims(),
-        grady.get_dims(), gradw_dims, args...);
+        grady.get_dims(), gradw_dims,
+        static_cast<int>(engine::channels_last()), args...);
 
     fetch_or_create_m(comp, key, src.get_descriptor(),
         grady.get_descriptor(), gradw_desc, std::forward<Ts>(args)...);
@@ -2691,6 +3166,8 @@ public:
     else if (tars.size() == 1)
       do_compute(deps[0], deps[1], deps[2], deps[3], tars[0]);
   }
+
+  virtual bool computes_weight_gradient() const { return true; }
 };
 
 struct convolution_transpose_forward
@@ -2928,7 +3405,7 @@ struct convolution_transpose_forward
       tensor& dst,
       Ts&&... args) {
     tensor::descriptor result_desc(dst_dims, src.get_data_type());
-    std::string key = utils::create_key(
+    auto key = utils::create_key(
         src.get_data_type(),
         src.get_dims(),
         weights.get_dims(),
@@ -3739,7 +4216,7 @@ struct pooling_forward : public computation,
       mkldnn::memory::validate_dims(padding_l);
       mkldnn::memory::validate_dims(padding_r);
       auto src_data = x_desc.get_mkldnn_memory_desc_t();
-      auto dst_data = y_desc.format_any();
+      auto dst_data = y_desc.format_activation();
       mkldnn_pooling_desc_t data;
       error::wrap_c_api(mkldnn_pooling_forward_desc_init(&data,
             mkldnn::convert_to_c(aprop_kind),
@@ -3799,8 +4276,10 @@ public:
       padding_kind apadding_kind = padding_kind::zero) {
     if (key.empty())
       key = utils::create_key(src.get_data_type(), src.get_dims(),
-          src.get_internal_format(), dst_dims, strides, kernel, padding_l,
-          padding_r, aalgorithm, aprop_kind, apadding_kind);
+          src.get_internal_format(),
+          static_cast<int>(engine::channels_last()), dst_dims, strides,
+          kernel, padding_l, padding_r, aalgorithm, aprop_kind,
+          apadding_kind);
 
     tensor::descriptor dst_desc(dst_dims, src.get_data_type());
     fetch_or_create_m(comp, key, src.get_descriptor(),
@@ -3868,7 +4347,7 @@ struct pooling_backward : public computation,
               mkldnn::memory::validate_dims(padding_l);
               mkldnn::memory::validate_dims(padding_r);
               auto gradx_data = gradx_desc.get_mkldnn_memory_desc_t();
-              auto grady_data = grady_desc.format_any();
+              auto grady_data = grady_desc.format_activation();
               mkldnn_pooling_desc_t data;
               error::wrap_c_api(mkldnn_pooling_forward_desc_init(&data,
                     mkldnn::convert_to_c(prop_kind::forward),
@@ -3891,7 +4370,7 @@ struct pooling_backward : public computation,
       mkldnn::memory::validate_dims(kernel);
       mkldnn::memory::validate_dims(padding_l);
       mkldnn::memory::validate_dims(padding_r);
-      auto gradx_data = gradx_desc.format_any();
+      auto gradx_data = gradx_desc.format_activation();
       mkldnn_pooling_desc_t data;
       error::wrap_c_api(mkldnn_pooling_backward_desc_init(&data,
             convert_to_c(aalgorithm),
@@ -3961,8 +4440,9 @@ public:
           grady.get_data_type(), x.get_internal_format()});
 
     auto key = utils::create_key(grady_in.get_data_type(), grady_in.get_dims(),
-        grady_in.get_internal_format(), x.get_dims(), strides, kernel, padding_l,
-        padding_r, aalgorithm, apadding_kind);
+        grady_in.get_internal_format(),
+        static_cast<int>(engine::channels_last()), x.get_dims(), strides,
+        kernel, padding_l, padding_r, aalgorithm, apadding_kind);
 
     fetch_or_create_m(comp, key, x.get_descriptor(),
         grady_in.get_descriptor(), strides, kernel, padding_l, padding_r,
@@ -4105,6 +4585,8 @@ public:
       std::vector<tensor>& deps, std::vector<tensor>& tars) {
     do_compute(deps[0], tars[0]);
   }
+
+  virtual bool can_compute_inplace() const { return true; }
 };
 
 struct eltwise_backward : public computation,
@@ -4241,7 +4723,7 @@ public:
           auto* X_offset = (X + g * K * S + n * C * S + S * i);
           auto* Y_offset = (Y + g * S + n * C * S + group * S * i);
 #ifdef __AVX2__
-          FM_AVX2_PREF::memcpy<float>(X_offset, Y_offset, S);
+          FM_PREF::memcpy<float>(X_offset, Y_offset, S);
 #else
           std::memcpy(Y_offset, X_offset, sizeof(float) * S);
 #endif
@@ -4256,7 +4738,7 @@ public:
     IDEEP_ENFORCE(src.ndims() == 4, "Only support 4 dims");
 
     auto src_in = src;
-    if (!src_in.is_public_format()) {
+    if (src_in.get_internal_format() != format::nchw) {
       src_in.init<alloc, channel_shuffle_forward>(
           {src.get_dims(), src.get_data_type(), format::nchw});
       reorder::compute(src, src_in);
@@ -4299,7 +4781,7 @@ public:
           auto* dY_offset = (dY + g * S + n * C * S + group * S * i);
           auto* dX_offset = (dX + g * K * S + n * C * S + S * i);
 #ifdef __AVX2__
-          FM_AVX2_PREF::memcpy<float>(dY_offset, dX_offset, S);
+          FM_PREF::memcpy<float>(dY_offset, dX_offset, S);
 #else
           std::memcpy(dX_offset, dY_offset, sizeof(float) * S);
 #endif
@@ -4314,7 +4796,7 @@ public:
     IDEEP_ENFORCE(grady.ndims() == 4, "Only support 4 dims");
 
     auto grady_in = grady;
-    if (!grady_in.is_public_format()) {
+    if (grady_in.get_internal_format() != format::nchw) {
       grady_in.init<alloc, channel_shuffle_backward>(
           {grady.get_dims(), grady.get_data_type(), format::nchw});
       reorder::compute(grady, grady_in);
@@ -5477,6 +5959,37 @@ struct inner_product_forward: public computation,
       do_compute(deps[0], deps[1], deps[2], deps[3], tars[0]);
   }
 
+  /// Reorder weights once into the format the inner product of a public
+  /// src of src_dims expects, see convolution_forward::prepack_weights
+  template<class alloc = utils::allocator>
+  static tensor prepack_weights(
+      const tensor::dims& src_dims, const tensor& weights) {
+    IDEEP_ENFORCE(!weights.has_scale()
+        && weights.get_data_type() == tensor::data_type::f32,
+          "INT8 mode is not supported");
+
+    // src is reshaped to the rank of weights by compute
+    auto src_dims_in = weights.get_dims();
+    src_dims_in[0] = src_dims[0];
+    tensor::descriptor src_desc(src_dims_in, weights.get_data_type());
+    tensor::dims dst_dims = {src_dims[0], weights.get_dim(0)};
+    tensor::descriptor dst_desc(dst_dims, weights.get_data_type());
+    auto key = utils::create_key(src_desc.get_data_type(), src_dims_in,
+        weights.get_dims(), dst_dims);
+
+    fetch_or_create_m(comp, key, src_desc,
+        weights.get_descriptor(), dst_desc);
+
+    if (weights.get_descriptor() == comp.expected_weights_descriptor())
+      return weights;
+
+    tensor packed;
+    packed.init<alloc, inner_product_forward>(
+        comp.expected_weights_descriptor());
+    reorder::compute(weights, packed);
+    return packed;
+  }
+
   static tensor::descriptor expected_weights_descriptor(
       const tensor::dims& weights_dims,
       tensor::data_type dtype = tensor::data_type::f32) {
@@ -5804,6 +6317,8 @@ public:
     else if (tars.size() == 1)
       do_compute(deps[0], deps[1], deps[2], deps[3], tars[0]);
   }
+
+  virtual bool computes_weight_gradient() const { return true; }
 };
 
 struct dropout_forward : public utils::computation_web::node<tensor> {
@@ -6041,7 +6556,7 @@ public:
       switch (op) {
       case ELTWISE_ADD:
 #ifdef __AVX2__
-        FM_AVX2_PREF::add<float>(
+        FM_PREF::add<float>(
             static_cast<float*>(outputC.get_data_handle()),
             static_cast<float*>(inputA.get_data_handle()),
             static_cast<float*>(inputB_data),
@@ -6496,7 +7011,7 @@ public:
     tensor dst;
     dst.init({get_dst_dims(src.get_dims(), axis),
               src.get_data_type(),
-              engine::default_format(dst_ndims)});
+              engine::plain_format(dst_ndims)});
 
     if (web_opt) {
       auto cn = utils::computation_web::template computation_node<
@@ -6529,7 +7044,7 @@ public:
     tensor src_in = src;
     if (src.get_dims()[1] % 16 != 0 && src.get_dims()[1] % 8 != 0 && src.ndims() == 4) {
       if (int(src.get_internal_format()) != mkldnn_nchw) {
-        src_in.init({src.get_dims(), src.get_data_type(), engine::default_format(4)});
+        src_in.init({src.get_dims(), src.get_data_type(), engine::plain_format(4)});
         reorder::compute(src, src_in);
       }
     } else if (src.get_dims()[1] % 8 == 0 && src.get_dims()[1] % 16 != 0 && src.ndims() == 4) {
@@ -6537,6 +7052,9 @@ public:
         src_in.init({src.get_dims(), src.get_data_type(), format(mkldnn_nChw8c)});
         reorder::compute(src, src_in);
       }
+    } else if (src.ndims() == 4 && src.get_internal_format() == format::nhwc) {
+      src_in.init({src.get_dims(), src.get_data_type(), format(mkldnn_nChw16c)});
+      reorder::compute(src, src_in);
     }
     if (optimized_format(src_in))
       return sum_fast_along_axis<web_opt>(src_in, axis, err);
@@ -5,12 +5,32 @@
 #include <type_traits>
 #include <immintrin.h>
 #include "abstract_types.hpp"
+#include "utils.hpp"
 
 #ifdef __AVX2__
 
 #define FM_AVX2_PREF \
   ideep::utils::fast_math<ideep::utils::cpu_isa_t::avx2>
 
+// AVX-512 kernels are built into every gcc/clang binary with the
+// avx512f target attribute, and are picked at runtime through FM_PREF
+#if defined(__AVX512F__)
+#define IDEEP_FM_AVX512
+#define IDEEP_TARGET_AVX512
+#elif defined(__GNUC__)
+#define IDEEP_FM_AVX512
+#define IDEEP_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+#ifdef IDEEP_FM_AVX512
+#define FM_AVX512_PREF \
+  ideep::utils::fast_math<ideep::utils::cpu_isa_t::avx512_common>
+#endif
+
+// Pick the widest implementation the running cpu supports
+#define FM_PREF \
+  ideep::utils::fast_math<ideep::utils::cpu_isa_t::isa_any>
+
 namespace ideep {
 namespace utils {
 
@@ -24,21 +44,54 @@ typedef enum {
     avx512_mic_4ops,
 } cpu_isa_t;
 
+static inline bool mayiuse(cpu_isa_t isa) {
+#if defined(__GNUC__)
+  switch (isa) {
+  case isa_any:
+    return true;
+  case sse42:
+    return __builtin_cpu_supports("sse4.2");
+  case avx2:
+    return __builtin_cpu_supports("avx2");
+  case avx512_common:
+    return __builtin_cpu_supports("avx512f");
+  case avx512_core:
+    return __builtin_cpu_supports("avx512f")
+      && __builtin_cpu_supports("avx512bw")
+      && __builtin_cpu_supports("avx512vl")
+      && __builtin_cpu_supports("avx512dq");
+  default:
+    return false;
+  }
+#else
+  // Trust what compiler targets
+  switch (isa) {
+  case isa_any:
+  case sse42:
+  case avx2:
+    return true;
+#ifdef __AVX512F__
+  case avx512_common:
+    return true;
+#endif
+  default:
+    return false;
+  }
+#endif
+}
 
+/// Vector primitives of a specific ISA, fast_math kernels are written
+/// against them.
 template<cpu_isa_t isa = avx2>
-class fast_math {
-  static constexpr int thread_hold = 1024;
+class fast_math_base {
+public:
+  static constexpr cpu_isa_t vec_isa = avx2;
+  static constexpr int vec_bytes = 32;
   static constexpr int align_bytes = 32;
 
-public:
   using TF = __m256;
   using TI = __m256i;
 
-  template<typename T>
-  static inline unsigned get_vec_sz() {
-    return 256 / 8 / sizeof(T);
-  }
-
   static inline TI size_to_mask(unsigned nres) {
     IDEEP_ENFORCE(nres < 8 && nres >= 0, "Invalid mask size");
     std::bitset<8> e = ~((1 << nres) - 1);
@@ -90,6 +143,37 @@ public:
   static inline void maskstore_ps(T *dst, TI mask, TF v) {
     _mm256_maskstore_ps(dst, mask, v);
   }
+};
+
+
+template<cpu_isa_t isa = avx2>
+class fast_math : public fast_math_base<isa> {
+  using base = fast_math_base<isa>;
+
+  static constexpr int thread_hold = 1024;
+  static constexpr int align_bytes = base::align_bytes;
+  static constexpr int cache_line_bytes = 64;
+
+public:
+  using TF = typename base::TF;
+  using TI = typename base::TI;
+
+  using base::size_to_mask;
+  using base::add_ps;
+  using base::sub_ps;
+  using base::mul_ps;
+  using base::div_ps;
+  using base::sqrt_ps;
+  using base::set1_ps;
+  using base::load_ps;
+  using base::maskload_ps;
+  using base::store_ps;
+  using base::maskstore_ps;
+
+  template<typename T>
+  static inline unsigned get_vec_sz() {
+    return base::vec_bytes / sizeof(T);
+  }
 
   template<class T = float>
   static inline void memcpy(T* src, T* dst, size_t size) {
@@ -158,17 +242,44 @@ public:
     }
   }
 
+  // Split nelems into cache line aligned chunks, one chunk per thread.
+  // The last thread takes the residue, which is then handled by the
+  // masked tail of the single thread kernel.
+  template<typename T = float>
+  static inline void partition(size_t nelems, int nthr, int ithr,
+      size_t &start, size_t &end) {
+    const size_t block_sz = cache_line_bytes / sizeof(T);
+    balance211(nelems / block_sz, static_cast<size_t>(nthr),
+        static_cast<size_t>(ithr), start, end);
+    start *= block_sz;
+    end *= block_sz;
+    if (ithr == nthr - 1)
+      end = nelems;
+  }
+
   template<typename vec_op, typename vec_op_mask, typename T = float>
   static inline void vecwise_unary_op (T *dst, const T *src, size_t nelems,
       vec_op op, vec_op_mask op_mask) {
-    if (nelems < thread_hold)
+    if (nelems < thread_hold || omp_in_parallel()) {
       single_thread_vecwise_unary_op(dst, src, nelems, op, op_mask);
+      return;
+    }
+
+#   pragma omp parallel
+    {
+      size_t start {0}, end {0};
+      partition<T>(nelems, omp_get_num_threads(), omp_get_thread_num(),
+          start, end);
+      if (end > start)
+        single_thread_vecwise_unary_op(
+            dst + start, src + start, end - start, op, op_mask);
+    }
   }
 
   template<class T = float>
   static void inv_square_var(float epsilon,
       const T* inv_sqrt_var, T* variance, unsigned nelems) {
-    if (isa == avx2) {
+    if (isa == base::vec_isa) {
       if (std::is_same<T, float>::value) {
         const float *src = reinterpret_cast<const float *>(inv_sqrt_var);
         float *dst = reinterpret_cast<float *>(variance);
@@ -200,33 +311,29 @@ public:
   template<class T = float>
   static void inv_sqrt_var(float epsilon,
       const void* variance, void* inv_sqrt_var, unsigned nelems) {
-    if (isa == avx2) {
+    if (isa == base::vec_isa) {
       if (std::is_same<T, float>::value) {
         const float *src =
           reinterpret_cast<const float *>(variance);
         float *dst =
           reinterpret_cast<float *>(inv_sqrt_var);
 
-        unsigned nvec = nelems / 8;
-        unsigned nres = nelems % 8;
         TF ones = set1_ps(1.f);
         TF epsilones = set1_ps(epsilon);
-        for (unsigned vec = 0; vec < nvec; vec ++, src+=8, dst+=8) {
-          TF vmm1 = load_ps(src);
-          vmm1 = add_ps(vmm1, epsilones);
-          vmm1 = sqrt_ps(vmm1);
-          vmm1 = div_ps(ones, vmm1);
-          store_ps(dst, vmm1);
-        }
-
-        if (nres != 0) {
-          TI mask = size_to_mask(nres);
-          TF vmm1 = maskload_ps(src, mask);
+        auto vec_inv_sqrt = [ones, epsilones] (TF vmm1) {
           vmm1 = add_ps(vmm1, epsilones);
           vmm1 = sqrt_ps(vmm1);
           vmm1 = div_ps(ones, vmm1);
-          maskstore_ps(dst, mask, vmm1);
-        }
+          return vmm1;
+        };
+        auto mask_vec_inv_sqrt =
+          [ones, epsilones] (TF vmm1, TI) {
+            vmm1 = add_ps(vmm1, epsilones);
+            vmm1 = sqrt_ps(vmm1);
+            vmm1 = div_ps(ones, vmm1);
+            return vmm1;
+        };
+        vecwise_unary_op(dst, src, nelems, vec_inv_sqrt, mask_vec_inv_sqrt);
       } else {
         throw error(mkldnn_unimplemented, "Not implemented!");
       }
@@ -263,8 +370,20 @@ public:
   template<typename vec_op, typename vec_op_mask, typename T = float>
   static inline void vecwise_binary_op (T *dst, const T *src1, const T *src2,
       size_t nelems, vec_op op, vec_op_mask op_mask) {
-    if (nelems < thread_hold)
+    if (nelems < thread_hold || omp_in_parallel()) {
       single_thread_vecwise_binary_op(dst, src1, src2, nelems, op, op_mask);
+      return;
+    }
+
+#   pragma omp parallel
+    {
+      size_t start {0}, end {0};
+      partition<T>(nelems, omp_get_num_threads(), omp_get_thread_num(),
+          start, end);
+      if (end > start)
+        single_thread_vecwise_binary_op(dst + start, src1 + start,
+            src2 + start, end - start, op, op_mask);
+    }
   }
 
   template<class T = float>
@@ -282,6 +401,237 @@ public:
   }
 
 };
+
+#ifdef IDEEP_FM_AVX512
+/// AVX-512 kernels, 16-wide __m512 registers with __mmask16 tails. Each
+/// kernel carries the avx512f target itself rather than relying on the
+/// compiler flags, so it must only be called once mayiuse() agreed.
+template<>
+class fast_math<avx512_common> {
+  static constexpr int thread_hold = 1024;
+
+  using TF = __m512;
+  using TI = __mmask16;
+
+public:
+  static constexpr cpu_isa_t vec_isa = avx512_common;
+
+  template<typename T>
+  static inline unsigned get_vec_sz() {
+    return 64 / sizeof(T);
+  }
+
+  static inline TI size_to_mask(unsigned nres) {
+    IDEEP_ENFORCE(nres < 16 && nres >= 0, "Invalid mask size");
+    return static_cast<TI>((1u << nres) - 1);
+  }
+
+  template<class T = float>
+  static inline void memcpy(T* src, T* dst, size_t size) {
+    if (!std::is_same<T, float>::value) {
+      std::memcpy(dst, src, sizeof(T) * size);
+      return;
+    }
+    copy_kernel(reinterpret_cast<const float *>(src),
+        reinterpret_cast<float *>(dst), size);
+  }
+
+  template<class T = float>
+  static void inv_square_var(float epsilon,
+      const T* inv_sqrt_var, T* variance, unsigned nelems) {
+    if (!std::is_same<T, float>::value)
+      throw error(mkldnn_unimplemented, "Not implemented!");
+
+    auto src = reinterpret_cast<const float *>(inv_sqrt_var);
+    auto dst = reinterpret_cast<float *>(variance);
+    parallel<float>(nelems, [=](size_t start, size_t end) {
+      inv_square_kernel(dst + start, src + start, end - start, epsilon);
+    });
+  }
+
+  template<class T = float>
+  static void inv_sqrt_var(float epsilon,
+      const void* variance, void* inv_sqrt_var, unsigned nelems) {
+    if (!std::is_same<T, float>::value)
+      throw error(mkldnn_unimplemented, "Not implemented!");
+
+    auto src = reinterpret_cast<const float *>(variance);
+    auto dst = reinterpret_cast<float *>(inv_sqrt_var);
+    parallel<float>(nelems, [=](size_t start, size_t end) {
+      inv_sqrt_kernel(dst + start, src + start, end - start, epsilon);
+    });
+  }
+
+  template<class T = float>
+  static void add(T *dst, const T *src1, const T *src2,
+      unsigned nelems) {
+    if (!std::is_same<T, float>::value)
+      throw error(mkldnn_unimplemented, "Not implemented!");
+
+    auto d = reinterpret_cast<float *>(dst);
+    auto s1 = reinterpret_cast<const float *>(src1);
+    auto s2 = reinterpret_cast<const float *>(src2);
+    parallel<float>(nelems, [=](size_t start, size_t end) {
+      add_kernel(d + start, s1 + start, s2 + start, end - start);
+    });
+  }
+
+private:
+  // Same chunking as the avx2 kernels, kernel(start, end) per thread
+  template<typename T, typename kernel_t>
+  static inline void parallel(size_t nelems, kernel_t kernel) {
+    if (nelems < thread_hold || omp_in_parallel()) {
+      kernel(0, nelems);
+      return;
+    }
+
+#   pragma omp parallel
+    {
+      size_t start {0}, end {0};
+      fast_math<avx2>::partition<T>(nelems, omp_get_num_threads(),
+          omp_get_thread_num(), start, end);
+      if (end > start)
+        kernel(start, end);
+    }
+  }
+
+  IDEEP_TARGET_AVX512
+  static void copy_kernel(const float *src, float *dst, size_t nelems) {
+    size_t i = 0;
+    for (; i + 16 <= nelems; i += 16)
+      _mm512_storeu_ps(dst + i, _mm512_loadu_ps(src + i));
+    if (i < nelems) {
+      TI mask = size_to_mask(nelems - i);
+      _mm512_mask_storeu_ps(dst + i, mask, _mm512_maskz_loadu_ps(mask, src + i));
+    }
+  }
+
+  IDEEP_TARGET_AVX512
+  static void inv_square_kernel(float *dst, const float *src,
+      size_t nelems, float epsilon) {
+    TF ones = _mm512_set1_ps(1.f);
+    TF epsilones = _mm512_set1_ps(epsilon);
+    size_t i = 0;
+    for (; i + 16 <= nelems; i += 16) {
+      TF vmm1 = _mm512_loadu_ps(src + i);
+      vmm1 = _mm512_add_ps(_mm512_mul_ps(vmm1, vmm1), epsilones);
+      _mm512_storeu_ps(dst + i, _mm512_div_ps(ones, vmm1));
+    }
+    // Masked off lanes are neither read nor faulted
+    if (i < nelems) {
+      TI mask = size_to_mask(nelems - i);
+      TF vmm1 = _mm512_maskz_loadu_ps(mask, src + i);
+      vmm1 = _mm512_add_ps(_mm512_mul_ps(vmm1, vmm1), epsilones);
+      _mm512_mask_storeu_ps(dst + i, mask, _mm512_div_ps(ones, vmm1));
+    }
+  }
+
+  // Zero masking sqrt, unmasked one trips -Wmaybe-uninitialized in gcc
+  IDEEP_TARGET_AVX512
+  static void inv_sqrt_kernel(float *dst, const float *src,
+      size_t nelems, float epsilon) {
+    TF ones = _mm512_set1_ps(1.f);
+    TF epsilones = _mm512_set1_ps(epsilon);
+    const TI all = static_cast<TI>(0xFFFF);
+    size_t i = 0;
+    for (; i + 16 <= nelems; i += 16) {
+      TF vmm1 = _mm512_add_ps(_mm512_loadu_ps(src + i), epsilones);
+      vmm1 = _mm512_maskz_sqrt_ps(all, vmm1);
+      _mm512_storeu_ps(dst + i, _mm512_div_ps(ones, vmm1));
+    }
+    if (i < nelems) {
+      TI mask = size_to_mask(nelems - i);
+      TF vmm1 = _mm512_add_ps(_mm512_maskz_loadu_ps(mask, src + i), epsilones);
+      vmm1 = _mm512_maskz_sqrt_ps(all, vmm1);
+      _mm512_mask_storeu_ps(dst + i, mask, _mm512_div_ps(ones, vmm1));
+    }
+  }
+
+  IDEEP_TARGET_AVX512
+  static void add_kernel(float *dst, const float *src1, const float *src2,
+      size_t nelems) {
+    size_t i = 0;
+    for (; i + 16 <= nelems; i += 16)
+      _mm512_storeu_ps(dst + i, _mm512_add_ps(
+            _mm512_loadu_ps(src1 + i), _mm512_loadu_ps(src2 + i)));
+    if (i < nelems) {
+      TI mask = size_to_mask(nelems - i);
+      _mm512_mask_storeu_ps(dst + i, mask, _mm512_add_ps(
+            _mm512_maskz_loadu_ps(mask, src1 + i),
+            _mm512_maskz_loadu_ps(mask, src2 + i)));
+    }
+  }
+};
+#endif
+
+/// Runtime dispatcher, forwards to the widest ISA the running cpu
+/// supports. AVX-512 kernels are available whenever the compiler can
+/// target them, independently of -mavx512f.
+template<>
+class fast_math<isa_any> {
+public:
+  static inline cpu_isa_t isa() {
+    static const cpu_isa_t isa_ = []() {
+#ifdef IDEEP_FM_AVX512
+      if (mayiuse(avx512_common))
+        return avx512_common;
+#endif
+      return avx2;
+    }();
+    return isa_;
+  }
+
+  template<class T = float>
+  static inline void memcpy(T* src, T* dst, size_t size) {
+#ifdef IDEEP_FM_AVX512
+    if (isa() == avx512_common) {
+      fast_math<avx512_common>::memcpy<T>(src, dst, size);
+      return;
+    }
+#endif
+    fast_math<avx2>::memcpy<T>(src, dst, size);
+  }
+
+  template<class T = float>
+  static void inv_square_var(float epsilon,
+      const T* inv_sqrt_var, T* variance, unsigned nelems) {
+#ifdef IDEEP_FM_AVX512
+    if (isa() == avx512_common) {
+      fast_math<avx512_common>::inv_square_var<T>(
+          epsilon, inv_sqrt_var, variance, nelems);
+      return;
+    }
+#endif
+    fast_math<avx2>::inv_square_var<T>(
+        epsilon, inv_sqrt_var, variance, nelems);
+  }
+
+  template<class T = float>
+  static void inv_sqrt_var(float epsilon,
+      const void* variance, void* inv_sqrt_var, unsigned nelems) {
+#ifdef IDEEP_FM_AVX512
+    if (isa() == avx512_common) {
+      fast_math<avx512_common>::inv_sqrt_var<T>(
+          epsilon, variance, inv_sqrt_var, nelems);
+      return;
+    }
+#endif
+    fast_math<avx2>::inv_sqrt_var<T>(
+        epsilon, variance, inv_sqrt_var, nelems);
+  }
+
+  template<class T = float>
+  static void add(T *dst, const T *src1, const T *src2,
+      unsigned nelems) {
+#ifdef IDEEP_FM_AVX512
+    if (isa() == avx512_common) {
+      fast_math<avx512_common>::add<T>(dst, src1, src2, nelems);
+      return;
+    }
+#endif
+    fast_math<avx2>::add<T>(dst, src1, src2, nelems);
+  }
+};
 }
 }
 #endif
@@ -4,6 +4,21 @@
 #include <string>
 #include <unordered_map>
 #include <list>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <thread>
+#include <tuple>
+#include <typeinfo>
+#include <unordered_set>
 #ifdef WIN32
 #include <intrin.h>
 #endif
@@ -42,7 +57,7 @@ public:
 
   lru_cache(size_type capacity) : capacity_(capacity) {}
 
-  size_type size() const { map_.size(); }
+  size_type size() const { return map_.size(); }
   size_type max_size() const { return capacity_; }
   void resize(size_type new_capacity) {
     capacity_ = new_capacity;
@@ -182,7 +197,7 @@ public:
 
   lru_multicache(size_type capacity) : capacity_(capacity) {}
 
-  size_type size() const { map_.size(); }
+  size_type size() const { return map_.size(); }
   size_type max_size() const { return capacity_; }
   void resize(size_type new_capacity) {
     capacity_ = new_capacity;
@@ -294,117 +309,1019 @@ private:
   size_type capacity_;
 };
 
-template <class value_t, size_t capacity = 128, class key_t = std::string>
-class computation_cache {
+template <size_t ...Is>
+struct index_seq {};
+
+template <size_t N, size_t ...Is>
+struct make_index_seq : make_index_seq<N - 1, N - 1, Is...> {};
+
+template <size_t ...Is>
+struct make_index_seq<0, Is...> {
+  using type = index_seq<Is...>;
+};
+
+/// Bounds checked cursor over serialized bytes
+struct byte_reader {
+  byte_reader(const char *begin, const char *end) : cur(begin), end(end) {}
+
+  void read(void *dst, size_t len) {
+    IDEEP_ENFORCE(len <= static_cast<size_t>(end - cur),
+        "truncated cache manifest");
+    std::memcpy(dst, cur, len);
+    cur += len;
+  }
+
+  const char *cur;
+  const char *end;
+};
+
+template <typename T, typename = void>
+struct has_serialize : std::false_type {};
+
+template <typename T>
+struct has_serialize<T, decltype(std::declval<const T&>().serialize(
+      std::declval<bytestring&>()), void())> : std::true_type {};
+
+/// Whether a computation creation argument can be kept in a cache manifest
+template <typename T>
+struct is_serializable : std::integral_constant<bool,
+  std::is_arithmetic<T>::value || std::is_enum<T>::value
+  || has_serialize<T>::value> {};
+
+template <typename T>
+struct is_serializable<std::vector<T>> : is_serializable<T> {};
+
+template <>
+struct is_serializable<tensor::descriptor> : std::true_type {};
+
+template <typename ...Ts>
+struct all_serializable : std::true_type {};
+
+template <typename T, typename ...Ts>
+struct all_serializable<T, Ts...> : std::integral_constant<bool,
+  is_serializable<T>::value && all_serializable<Ts...>::value> {};
+
+template <typename T, typename = typename std::enable_if<
+  std::is_arithmetic<T>::value || std::is_enum<T>::value>::type>
+inline void serialize(bytestring &bytes, const T arg) {
+  bytes.append(reinterpret_cast<const char *>(&arg), sizeof(T));
+}
+
+template <typename T, typename = typename std::enable_if<
+  std::is_arithmetic<T>::value || std::is_enum<T>::value>::type>
+inline void deserialize(byte_reader &reader, T &arg) {
+  reader.read(&arg, sizeof(T));
+}
+
+template <typename T, typename = typename std::enable_if<
+  has_serialize<T>::value>::type, typename = void>
+inline void serialize(bytestring &bytes, const T &arg) {
+  arg.serialize(bytes);
+}
+
+template <typename T, typename = typename std::enable_if<
+  has_serialize<T>::value>::type, typename = void>
+inline void deserialize(byte_reader &reader, T &arg) {
+  arg.deserialize(reader);
+}
+
+inline void serialize(bytestring &bytes, const tensor::descriptor &arg) {
+  auto md = arg.get_mkldnn_memory_desc_t();
+  bytes.append(reinterpret_cast<const char *>(md), sizeof(*md));
+}
+
+inline void deserialize(byte_reader &reader, tensor::descriptor &arg) {
+  mkldnn_memory_desc_t md;
+  reader.read(&md, sizeof(md));
+
+  mkldnn_primitive_desc_t result;
+  error::wrap_c_api(mkldnn_memory_primitive_desc_create(&result, &md,
+        engine::cpu_engine().get()),
+      "could not initialize a memory descriptor");
+  arg = tensor::descriptor(result);
+}
+
+template <typename T>
+inline void serialize(bytestring &bytes, const std::vector<T> &arg) {
+  serialize(bytes, static_cast<uint64_t>(arg.size()));
+  for (const auto &elems : arg)
+    serialize(bytes, elems);
+}
+
+template <typename T>
+inline void deserialize(byte_reader &reader, std::vector<T> &arg) {
+  uint64_t size;
+  deserialize(reader, size);
+  IDEEP_ENFORCE(size <= static_cast<uint64_t>(reader.end - reader.cur),
+      "truncated cache manifest");
+  arg.resize(size);
+  for (auto &elems : arg)
+    deserialize(reader, elems);
+}
+
+inline void serialize_args(bytestring &bytes) {}
+
+template <typename T, typename ...Ts>
+inline void serialize_args(bytestring &bytes, const T &arg,
+    const Ts&... args) {
+  serialize(bytes, arg);
+  serialize_args(bytes, args...);
+}
+
+template <typename tuple_t, size_t ...Is>
+inline void deserialize_args(byte_reader &reader, tuple_t &args,
+    index_seq<Is...>) {
+  // Braced list keeps left to right order
+  int dummy[] = {0, (deserialize(reader, std::get<Is>(args)), 0)...};
+  (void)dummy;
+}
+
+/// Manifest of computations created through computation_cache.
+///
+/// While recording, every cache creation with serializable arguments is
+/// remembered together with its key. save() writes them to a file and
+/// warm_up() re-creates them in a later run, so primitives are JIT-ed
+/// before the first request. Thread local caches only get warm on the
+/// thread calling warm_up(), ops in shared mode (see computation_gcache)
+/// get warm for the whole process and can be replayed on several threads.
+class cache_manifest {
 public:
-  using iterator = typename lru_cache<key_t, value_t>::iterator;
+  using replay_func = void (*)(const key_t &, byte_reader &);
+  using shared_func = bool (*)();
+
+  static void start_recording() {
+    recording_flag().store(true, std::memory_order_relaxed);
+  }
+
+  static void stop_recording() {
+    recording_flag().store(false, std::memory_order_relaxed);
+  }
+
+  static bool is_recording() {
+    return recording_flag().load(std::memory_order_relaxed);
+  }
+
+  /// Drop what has been recorded so far
+  static void clear() {
+    std::lock_guard<std::mutex> lock(store().mutex);
+    store().records.clear();
+    store().seen.clear();
+  }
+
+  static size_t size() {
+    std::lock_guard<std::mutex> lock(store().mutex);
+    return store().records.size();
+  }
+
+  template <typename ...Ts>
+  static void record(const char *signature, const key_t &key,
+      const Ts&... args) {
+    record_t rec;
+    rec.signature = signature;
+    rec.key = key;
+    serialize_args(rec.args, args...);
+
+    bytestring id = rec.signature;
+    id.append(reinterpret_cast<const char *>(&key.lo), sizeof(key.lo));
+    id.append(reinterpret_cast<const char *>(&key.hi), sizeof(key.hi));
+
+    std::lock_guard<std::mutex> lock(store().mutex);
+    if (store().seen.insert(id).second)
+      store().records.push_back(std::move(rec));
+  }
+
+  static void save(const std::string &path) {
+    bytestring bytes(magic(), magic_len);
+    {
+      std::lock_guard<std::mutex> lock(store().mutex);
+      for (const auto &rec : store().records) {
+        serialize(bytes, static_cast<uint64_t>(rec.signature.size()));
+        bytes.append(rec.signature);
+        serialize(bytes, rec.key.lo);
+        serialize(bytes, rec.key.hi);
+#ifdef IDEEP_VERIFY_CACHE_KEY
+        serialize(bytes, static_cast<uint64_t>(rec.key.bytes.size()));
+        bytes.append(rec.key.bytes);
+#endif
+        serialize(bytes, static_cast<uint64_t>(rec.args.size()));
+        bytes.append(rec.args);
+      }
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    IDEEP_ENFORCE(out.good(), "could not write cache manifest");
+  }
+
+  /// Re-create computations listed in a manifest file, returns the number
+  /// created. Records of ops not built into this binary are skipped.
+  static size_t warm_up(const std::string &path, int nthreads = 1) {
+    std::ifstream in(path, std::ios::binary);
+    IDEEP_ENFORCE(in.good(), "could not open cache manifest");
+    bytestring bytes((std::istreambuf_iterator<char>(in)),
+        std::istreambuf_iterator<char>());
+
+    IDEEP_ENFORCE(bytes.size() >= magic_len
+        && bytes.compare(0, magic_len, magic(), magic_len) == 0,
+        "invalid cache manifest");
+
+    struct job_t {
+      replay_func replay;
+      key_t key;
+      byte_reader args;
+    };
+    std::vector<job_t> local_jobs, shared_jobs;
+
+    byte_reader reader(bytes.data() + magic_len,
+        bytes.data() + bytes.size());
+    while (reader.cur != reader.end) {
+      uint64_t len;
+      deserialize(reader, len);
+      bytestring signature(len, '\0');
+      reader.read(&signature[0], len);
+
+      key_t key;
+      deserialize(reader, key.lo);
+      deserialize(reader, key.hi);
+#ifdef IDEEP_VERIFY_CACHE_KEY
+      deserialize(reader, len);
+      key.bytes.resize(len);
+      reader.read(&key.bytes[0], len);
+#endif
+      deserialize(reader, len);
+      IDEEP_ENFORCE(len <= static_cast<uint64_t>(reader.end - reader.cur),
+          "truncated cache manifest");
+      byte_reader args(reader.cur, reader.cur + len);
+      reader.cur += len;
+
+      auto it = registry().find(signature);
+      if (it == registry().end())
+        continue;
+
+      job_t job {it->second.first, key, args};
+      if (it->second.second())
+        shared_jobs.push_back(job);
+      else
+        local_jobs.push_back(job);
+    }
+
+    std::atomic<size_t> created(0);
+    auto run = [&created](std::vector<job_t> &jobs, size_t start,
+        size_t step) {
+      for (auto i = start; i < jobs.size(); i += step) {
+        try {
+          jobs[i].replay(jobs[i].key, jobs[i].args);
+          created ++;
+        } catch (const std::exception &) {
+          // Primitive not available on this machine, skip it
+        }
+      }
+    };
+
+    auto nworkers = static_cast<size_t>(std::max(nthreads, 1));
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < nworkers; t ++)
+      workers.emplace_back(run, std::ref(shared_jobs), t, nworkers);
+    run(shared_jobs, 0, nworkers);
+    run(local_jobs, 0, 1);
+    for (auto &w : workers)
+      w.join();
+
+    return created.load();
+  }
+
+  static bool register_replay(const char *signature, replay_func replay,
+      shared_func shared) {
+    registry()[signature] = std::make_pair(replay, shared);
+    return true;
+  }
+
+private:
+  static constexpr size_t magic_len = 8;
+
+  static const char *magic() {
+    return "IDEEPCM1";
+  }
+
+  struct record_t {
+    bytestring signature;
+    key_t key;
+    bytestring args;
+  };
+
+  struct store_t {
+    std::mutex mutex;
+    std::vector<record_t> records;
+    std::unordered_set<bytestring> seen;
+  };
+
+  static std::atomic<bool> &recording_flag() {
+    static std::atomic<bool> recording(false);
+    return recording;
+  }
+
+  static store_t &store() {
+    static store_t store_;
+    return store_;
+  }
+
+  static std::unordered_map<bytestring, std::pair<replay_func, shared_func>>
+    &registry() {
+    static std::unordered_map<bytestring,
+      std::pair<replay_func, shared_func>> registry_;
+    return registry_;
+  }
+};
+
+/// Choices made by autotuning, such as the fastest convolution algorithm
+/// of a shape, keyed like computations.
+///
+/// ENABLE_AUTOTUNE=1 turns tuning on. AUTOTUNE_FILE names a file the table
+/// is read from on first use and rewritten whenever a choice is added, so
+/// later runs on the same machine skip the measurements.
+class tuning_table {
+public:
+  static bool is_enabled() {
+    return store().enabled.load(std::memory_order_relaxed);
+  }
+
+  static void set_enabled(bool on) {
+    store().enabled.store(on, std::memory_order_relaxed);
+  }
+
+  static bool find(const key_t &key, int &choice) {
+    std::lock_guard<std::mutex> lock(store().mutex);
+    auto it = store().choices.find(key);
+    if (it == store().choices.end())
+      return false;
+    choice = it->second;
+    return true;
+  }
+
+  static void insert(const key_t &key, int choice) {
+    std::string path;
+    {
+      std::lock_guard<std::mutex> lock(store().mutex);
+      store().choices[key] = choice;
+      path = store().path;
+    }
+    if (!path.empty())
+      save(path);
+  }
+
+  static size_t size() {
+    std::lock_guard<std::mutex> lock(store().mutex);
+    return store().choices.size();
+  }
+
+  static void clear() {
+    std::lock_guard<std::mutex> lock(store().mutex);
+    store().choices.clear();
+  }
+
+  /// File choices are persisted to, empty to keep them in memory only
+  static void set_path(const std::string &path) {
+    std::lock_guard<std::mutex> lock(store().mutex);
+    store().path = path;
+  }
+
+  /// Merge choices of a file, returns the number read
+  static size_t load(const std::string &path) {
+    std::unordered_map<key_t, int> choices;
+    auto count = read(path, choices);
+    std::lock_guard<std::mutex> lock(store().mutex);
+    for (const auto &c : choices)
+      store().choices[c.first] = c.second;
+    return count;
+  }
+
+  /// Rewrite the file with all choices. Saves are serialized, and each
+  /// goes through a temporary file renamed over path, so readers never see
+  /// a partial table.
+  static void save(const std::string &path) {
+    std::lock_guard<std::mutex> saving(store().save_mutex);
+    std::unordered_map<key_t, int> choices;
+    {
+      std::lock_guard<std::mutex> lock(store().mutex);
+      choices = store().choices;
+    }
+
+    auto temp = path + ".tmp";
+    {
+      std::ofstream out(temp, std::ios::trunc);
+      out << magic() << '\n';
+      for (const auto &c : choices)
+        out << std::hex << c.first.lo << ' ' << c.first.hi << ' '
+          << std::dec << c.second << '\n';
+      out.close();
+      IDEEP_ENFORCE(out.good(), "could not write tuning file");
+    }
+#ifdef _WIN32
+    std::remove(path.c_str());
+#endif
+    IDEEP_ENFORCE(std::rename(temp.c_str(), path.c_str()) == 0,
+        "could not write tuning file");
+  }
+
+private:
+  static const char *magic() {
+    return "IDEEPTT1";
+  }
+
+  static size_t read(const std::string &path,
+      std::unordered_map<key_t, int> &choices) {
+    std::ifstream in(path);
+    IDEEP_ENFORCE(in.good(), "could not open tuning file");
+    std::string header;
+    IDEEP_ENFORCE(std::getline(in, header) && header == magic(),
+        "invalid tuning file");
+
+    size_t count = 0;
+    key_t key;
+    int choice;
+    while (in >> std::hex >> key.lo >> key.hi >> std::dec >> choice) {
+      choices[key] = choice;
+      count ++;
+    }
+    return count;
+  }
+
+  struct store_t {
+    store_t() {
+      const char *env = getenv("ENABLE_AUTOTUNE");
+      enabled = env != nullptr && *env != '0';
+      env = getenv("AUTOTUNE_FILE");
+      if (env != nullptr && *env != '\0') {
+        path = env;
+        std::ifstream exists(path);
+        if (exists.good()) {
+          try {
+            read(path, choices);
+          } catch (const std::exception &) {
+            // Start over, the file is rewritten on the next choice
+          }
+        }
+      }
+    }
+
+    std::atomic<bool> enabled;
+    std::mutex mutex, save_mutex;
+    std::string path;
+    std::unordered_map<key_t, int> choices;
+  };
+
+  static store_t &store() {
+    static store_t store_;
+    return store_;
+  }
+};
+
+/// Counters of a computation cache, creation_ns is the total time spent
+/// creating computations on misses
+struct cache_stats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t creation_ns;
+  size_t capacity;
+};
+
+struct cache_counters {
+  cache_counters() : hits(0), misses(0), evictions(0), creation_ns(0) {}
+
+  void reset() {
+    hits = 0;
+    misses = 0;
+    evictions = 0;
+    creation_ns = 0;
+  }
+
+  // Constructs a computation, accounting it as a miss
+  template <typename value_t, typename ...Ts>
+  value_t make(Ts&&... args) {
+    auto start = std::chrono::steady_clock::now();
+    value_t ret(std::forward<Ts>(args)...);
+    account(start);
+    return ret;
+  }
+
+  template <typename value_t, typename ...Ts>
+  value_t *create(Ts&&... args) {
+    auto start = std::chrono::steady_clock::now();
+    auto ret = new value_t(std::forward<Ts>(args)...);
+    account(start);
+    return ret;
+  }
+
+  void account(std::chrono::steady_clock::time_point start) {
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    misses.fetch_add(1, std::memory_order_relaxed);
+    creation_ns.fetch_add(static_cast<uint64_t>(elapsed),
+        std::memory_order_relaxed);
+  }
+
+  std::atomic<uint64_t> hits;
+  std::atomic<uint64_t> misses;
+  std::atomic<uint64_t> evictions;
+  std::atomic<uint64_t> creation_ns;
+};
+
+// Capacity of every computation cache unless set per op
+inline size_t default_cache_capacity(size_t capacity) {
+  static const long env_capacity = []() {
+    char *env = getenv("PRIMITIVE_CACHE_CAPACITY");
+    return env ? std::atol(env) : 0L;
+  }();
+  return env_capacity > 0 ? static_cast<size_t>(env_capacity) : capacity;
+}
+
+template <class value_t, size_t capacity, class key_t>
+class computation_cache;
+
+/// Process-wide computation cache shared by all threads.
+///
+/// A computation binds its memory handles, so a cached instance can only
+/// be used by one thread at a time. Each key keeps an instance per hardware
+/// thread, at least nslots; find() and create() check one out and the
+/// returned iterator gives it back when destroyed. With all of them busy
+/// create() waits for one rather than building a throwaway instance. Keys resolve through a per-thread index first, so
+/// steady state lookups take no lock, the sharded global map is locked only
+/// when a thread meets a key for the first time. Creation is serialized per
+/// key and late comers reuse what the first creator built.
+///
+/// Not for lazy (web) execution, a deferred node outlives the iterator.
+/// computation_node computes such ops eagerly, see deferrable().
+template <class value_t, size_t capacity = 128, class key_t = ideep::key_t,
+         int nslots = 8, size_t nshards = 16>
+class computation_gcache {
+  template <class, size_t, class> friend class computation_cache;
+
+  struct entry_t {
+    entry_t() : evicted(false), ninstances(0),
+      busy(new std::atomic<bool>[max_instances()]),
+      instances(new std::unique_ptr<value_t>[max_instances()]) {
+      for (int i = 0; i < max_instances(); i ++)
+        busy[i].store(false, std::memory_order_relaxed);
+    }
+
+    std::atomic<bool> evicted;
+    std::atomic<int> ninstances;
+    std::unique_ptr<std::atomic<bool>[]> busy;
+    std::unique_ptr<std::unique_ptr<value_t>[]> instances;
+    std::mutex create_mutex;
+  };
+
+  using entry_ptr = std::shared_ptr<entry_t>;
+
+  struct shard_t {
+    // Trimmed by lookup() so evictions get flagged
+    shard_t() : entries(std::numeric_limits<size_t>::max()) {}
+
+    std::mutex mutex;
+    lru_cache<key_t, entry_ptr> entries;
+  };
+
+public:
+  /// Exclusive handle of a cached instance
+  class iterator {
+  public:
+    iterator() : slot_(-1), value_(nullptr) {}
+
+    iterator(const entry_ptr &entry, int slot) : entry_(entry), slot_(slot),
+      value_(entry->instances[slot].get()) {}
+
+    iterator(iterator &&other) noexcept : entry_(std::move(other.entry_)),
+      slot_(other.slot_), value_(other.value_) {
+      other.slot_ = -1;
+      other.value_ = nullptr;
+    }
+
+    iterator &operator=(iterator &&other) noexcept {
+      if (this != &other) {
+        reset();
+        entry_ = std::move(other.entry_);
+        slot_ = other.slot_;
+        value_ = other.value_;
+        other.slot_ = -1;
+        other.value_ = nullptr;
+      }
+      return *this;
+    }
+
+    ~iterator() {
+      reset();
+    }
+
+    bool operator==(const iterator &other) const {
+      return value_ == other.value_;
+    }
+
+    bool operator!=(const iterator &other) const {
+      return value_ != other.value_;
+    }
+
+    value_t &operator*() const {
+      return *value_;
+    }
+
+  private:
+    void reset() {
+      if (entry_ && slot_ >= 0)
+        entry_->busy[slot_].store(false, std::memory_order_release);
+      entry_.reset();
+      slot_ = -1;
+      value_ = nullptr;
+    }
+
+    entry_ptr entry_;
+    int slot_;
+    value_t *value_;
+  };
 
 protected:
   template <typename ...Ts>
   static inline iterator create(const key_t& key, Ts&&... args) {
-    auto it = t_store().insert(
-        std::make_pair(key,value_t(std::forward<Ts>(args)...)));
-    return it.first;
+    auto entry = lookup(key, true);
+    {
+      std::lock_guard<std::mutex> lock(entry->create_mutex);
+
+      // Another creator might have finished while we were waiting
+      auto it = checkout(entry);
+      if (it != end()) {
+        counters().hits.fetch_add(1, std::memory_order_relaxed);
+        return it;
+      }
+
+      auto n = entry->ninstances.load(std::memory_order_relaxed);
+      if (n < max_instances()) {
+        entry->instances[n].reset(counters().template create<value_t>(
+              std::forward<Ts>(args)...));
+        entry->busy[n].store(true, std::memory_order_relaxed);
+        entry->ninstances.store(n + 1, std::memory_order_release);
+        return iterator(entry, n);
+      }
+    }
+
+    // More threads than instances, the busy ones are given back shortly
+    for (;;) {
+      auto it = checkout(entry);
+      if (it != end()) {
+        counters().hits.fetch_add(1, std::memory_order_relaxed);
+        return it;
+      }
+      std::this_thread::yield();
+    }
   }
 
-  static inline value_t& fetch(iterator it) {
-    return it->second;
+  static inline value_t& fetch(const iterator &it) {
+    return *it;
   }
 
-  static inline void update(value_t &val, iterator it) {
-    it->second = val;
+  static inline void update(value_t &val, const iterator &it) {
+    *it = val;
   }
 
   static inline iterator find(const key_t& key) {
-    return t_store().find(key);
+    auto entry = lookup(key, false);
+    auto it = entry ? checkout(entry) : end();
+    if (it != end())
+      counters().hits.fetch_add(1, std::memory_order_relaxed);
+    return it;
   }
 
   static inline iterator end() {
-    return t_store().end();
+    return iterator();
   }
 
 public:
-  template <typename ...Ts>
-  static inline value_t& fetch_or_create(const key_t& key, Ts&&... args) {
-    return fetch(create(key, std::forward<Ts>(args)...));
+  static inline cache_stats stats() {
+    auto &c = counters();
+    return {c.hits.load(), c.misses.load(), c.evictions.load(),
+      c.creation_ns.load(), get_capacity()};
   }
 
-  static inline void release(
-      const key_t& key, const value_t& computation) {
-    // Empty
+  static inline void reset_stats() {
+    counters().reset();
   }
 
-  static inline void release(
-      const key_t& key, value_t&& computation) {
-    // Empty
+  static inline size_t get_capacity() {
+    return capacity_value().load(std::memory_order_relaxed);
   }
 
-  static inline lru_cache<key_t, value_t> &t_store() {
-    static thread_local lru_cache<key_t, value_t> t_store_(capacity);
-    return t_store_;
+  /// Applied to each shard on its next insertion
+  static inline void set_capacity(size_t new_capacity) {
+    capacity_value().store(new_capacity, std::memory_order_relaxed);
+  }
+
+private:
+  static inline iterator checkout(const entry_ptr &entry) {
+    auto n = entry->ninstances.load(std::memory_order_acquire);
+    for (int i = 0; i < n; i ++) {
+      bool expected = false;
+      if (entry->busy[i].compare_exchange_strong(expected, true,
+            std::memory_order_acquire, std::memory_order_relaxed))
+        return iterator(entry, i);
+    }
+    return end();
+  }
+
+  static inline entry_ptr lookup(const key_t& key, bool insert) {
+    auto &index = t_index();
+    auto it = index.find(key);
+    if (it != index.end()) {
+      auto entry = it->second.lock();
+      if (entry && !entry->evicted.load(std::memory_order_relaxed))
+        return entry;
+      index.erase(it);
+    }
+
+    entry_ptr entry;
+    auto &shard = g_shard(key);
+    {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      auto git = shard.entries.find(key);
+      if (git != shard.entries.end()) {
+        entry = git->second;
+      } else if (insert) {
+        while (!shard.entries.empty()
+            && shard.entries.size() >= shard_capacity()) {
+          auto last = shard.entries.end();
+          last --;
+          last->second->evicted.store(true, std::memory_order_relaxed);
+          auto stale = index.find(last->first->first);
+          if (stale != index.end())
+            index.erase(stale);
+          shard.entries.erase(last);
+          counters().evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+        entry = std::make_shared<entry_t>();
+        shard.entries.insert(std::make_pair(key, entry));
+      }
+    }
+
+    if (entry)
+      index.insert(std::make_pair(key, entry));
+    return entry;
+  }
+
+  // Weak, an evicted entry dies with its last checkout, not with the index
+  static inline lru_cache<key_t, std::weak_ptr<entry_t>> &t_index() {
+    static thread_local lru_cache<key_t, std::weak_ptr<entry_t>>
+      t_index_(capacity);
+    return t_index_;
+  }
+
+  static inline shard_t &g_shard(const key_t& key) {
+    static shard_t g_shards_[nshards];
+    return g_shards_[std::hash<key_t>()(key) % nshards];
+  }
+
+  static inline size_t shard_capacity() {
+    return get_capacity() / nshards + 1;
+  }
+
+  static inline int max_instances() {
+    static const int max_instances_ = std::max<int>(nslots,
+        static_cast<int>(std::thread::hardware_concurrency()));
+    return max_instances_;
+  }
+
+  static inline std::atomic<size_t> &capacity_value() {
+    static std::atomic<size_t> capacity_(default_cache_capacity(capacity));
+    return capacity_;
+  }
+
+  static inline cache_counters &counters() {
+    static cache_counters counters_;
+    return counters_;
   }
 };
 
-// TODO: mutex it
-template <class value_t, size_t capacity = 128, class key_t = std::string>
-class computation_gcache {
+/// Per-op computation cache. Thread local by default, an op can be switched
+/// to the process-wide computation_gcache with set_shared(), or for all ops
+/// by setting ENABLE_SHARED_PRIMITIVE_CACHE. Switch before the op is used.
+template <class value_t, size_t capacity = 128, class key_t = ideep::key_t>
+class computation_cache {
+  using t_store_t = lru_cache<key_t, value_t>;
+  using g_store_t = computation_gcache<value_t, capacity, key_t>;
+
 public:
-  using iterator = typename lru_cache<key_t, value_t>::iterator;
+  class iterator {
+  public:
+    iterator() : shared_iter_(), is_shared_(false) {}
+
+    iterator(typename t_store_t::iterator local) : local_iter_(local),
+      shared_iter_(), is_shared_(false) {}
+
+    iterator(typename g_store_t::iterator &&shared) : local_iter_(),
+      shared_iter_(std::move(shared)), is_shared_(true) {}
+
+    bool operator==(const iterator &other) const {
+      return is_shared_ ? shared_iter_ == other.shared_iter_
+        : local_iter_ == other.local_iter_;
+    }
+
+    bool operator!=(const iterator &other) const {
+      return !(*this == other);
+    }
+
+    value_t &operator*() const {
+      return is_shared_ ? *shared_iter_ : local_iter_->second;
+    }
+
+  private:
+    typename t_store_t::iterator local_iter_;
+    typename g_store_t::iterator shared_iter_;
+    bool is_shared_;
+  };
+
+  static inline bool is_shared() {
+    return shared_flag().load(std::memory_order_relaxed);
+  }
+
+  static inline void set_shared(bool shared) {
+    shared_flag().store(shared, std::memory_order_relaxed);
+  }
 
 protected:
   template <typename ...Ts>
-  static inline value_t create(Ts&&... args) {
-    return value_t(std::forward<Ts>(args)...);
+  static inline iterator create(const key_t& key, Ts&&... args) {
+    record(key, args...);
+
+    if (is_shared())
+      return iterator(g_store_t::create(key, std::forward<Ts>(args)...));
+
+    auto &store = t_store();
+    auto found = store.find(key);
+    if (found != store.end()) {
+      counters().hits.fetch_add(1, std::memory_order_relaxed);
+      return iterator(found);
+    }
+
+    auto before = store.size();
+    auto it = store.insert(std::make_pair(key,
+          counters().template make<value_t>(std::forward<Ts>(args)...)));
+    if (store.size() <= before)
+      counters().evictions.fetch_add(before + 1 - store.size(),
+          std::memory_order_relaxed);
+    return iterator(it.first);
   }
 
-  static inline value_t& fetch(iterator it) {
-    auto comp = std::move(it->second);
-    g_store().erase(it);
-    return comp;
+  static inline value_t& fetch(const iterator &it) {
+    return *it;
+  }
+
+  static inline void update(value_t &val, const iterator &it) {
+    *it = val;
   }
 
   static inline iterator find(const key_t& key) {
-    return g_store().find(key);
+    if (is_shared())
+      return iterator(g_store_t::find(key));
+
+    auto it = t_store().find(key);
+#ifdef IDEEP_VERIFY_CACHE_KEY
+    IDEEP_ENFORCE(it == t_store().end() || it->first->first.bytes == key.bytes,
+        "primitive cache key collision");
+#endif
+    if (it != t_store().end())
+      counters().hits.fetch_add(1, std::memory_order_relaxed);
+    return iterator(it);
   }
 
   static inline iterator end() {
-    return g_store().end();
+    if (is_shared())
+      return iterator(g_store_t::end());
+    return iterator(t_store().end());
   }
 
 public:
+  // Always thread local, returned reference is only valid on this thread
   template <typename ...Ts>
   static inline value_t& fetch_or_create(const key_t& key, Ts&&... args) {
-    const auto it = g_store().find(key);
-
-    if (it != g_store().end()) {
-      value_t comp = std::move(it->second);
-      g_store().erase(it);
-      return comp;
-    }
-
-    return value_t(std::forward<Ts>(args)...);
+    auto it = t_store().insert(
+        std::make_pair(key,value_t(std::forward<Ts>(args)...)));
+    return it.first->second;
   }
 
   static inline void release(
       const key_t& key, const value_t& computation) {
-    g_store().insert(std::make_pair(key, computation));
+    // Empty
   }
 
   static inline void release(
       const key_t& key, value_t&& computation) {
-    g_store().insert(std::make_pair(key, std::move(computation)));
+    // Empty
+  }
+
+  /// Counters of this op, summed over the thread local and shared stores
+  static inline cache_stats stats() {
+    auto &c = counters();
+    auto shared = g_store_t::stats();
+    return {c.hits.load() + shared.hits, c.misses.load() + shared.misses,
+      c.evictions.load() + shared.evictions,
+      c.creation_ns.load() + shared.creation_ns, get_capacity()};
+  }
+
+  static inline void reset_stats() {
+    counters().reset();
+    g_store_t::reset_stats();
+  }
+
+  static inline size_t get_capacity() {
+    return capacity_value().load(std::memory_order_relaxed);
+  }
+
+  /// Per-thread stores pick the new capacity up on their next access
+  static inline void set_capacity(size_t new_capacity) {
+    capacity_value().store(new_capacity, std::memory_order_relaxed);
+    g_store_t::set_capacity(new_capacity);
+  }
+
+  static inline t_store_t &t_store() {
+    static thread_local t_store_t t_store_(get_capacity());
+    auto new_capacity = get_capacity();
+    if (t_store_.max_size() != new_capacity) {
+      auto before = t_store_.size();
+      t_store_.resize(new_capacity);
+      counters().evictions.fetch_add(before - t_store_.size(),
+          std::memory_order_relaxed);
+    }
+    return t_store_;
   }
 
-  static lru_cache<key_t, value_t> &g_store() {
-    static lru_cache<key_t, value_t> g_store_(capacity);
-    return g_store_;
+private:
+  template <typename ...Ts>
+  struct replayer {
+    static void replay(const key_t &key, byte_reader &reader) {
+      std::tuple<Ts...> args;
+      deserialize_args(reader, args,
+          typename make_index_seq<sizeof...(Ts)>::type());
+      create_from(key, args, typename make_index_seq<sizeof...(Ts)>::type());
+    }
+
+    template <size_t ...Is>
+    static void create_from(const key_t &key, std::tuple<Ts...> &args,
+        index_seq<Is...>) {
+      create(key, std::get<Is>(args)...);
+    }
+
+    static const char *signature() {
+      return typeid(replayer).name();
+    }
+
+    static const bool registered;
+  };
+
+  template <typename ...Ts>
+  static inline typename std::enable_if<all_serializable<
+    typename std::decay<Ts>::type...>::value>::type
+  record(const key_t &key, const Ts&... args) {
+    using replayer_t = replayer<typename std::decay<Ts>::type...>;
+    if (replayer_t::registered && cache_manifest::is_recording())
+      cache_manifest::record(replayer_t::signature(), key, args...);
+  }
+
+  template <typename ...Ts>
+  static inline typename std::enable_if<!all_serializable<
+    typename std::decay<Ts>::type...>::value>::type
+  record(const key_t &key, const Ts&... args) {}
+
+  static inline std::atomic<size_t> &capacity_value() {
+    static std::atomic<size_t> capacity_(default_cache_capacity(capacity));
+    return capacity_;
+  }
+
+  static inline cache_counters &counters() {
+    static cache_counters counters_;
+    return counters_;
+  }
+
+  static inline std::atomic<bool> &shared_flag() {
+    static std::atomic<bool> shared([]() {
+      char *env = getenv("ENABLE_SHARED_PRIMITIVE_CACHE");
+      return env != nullptr && *env != '0';
+    }());
+    return shared;
   }
 };
 
-// Possible better performance, but use inside class scope only (private)
+template <class value_t, size_t capacity, class key_t>
+template <typename ...Ts>
+const bool computation_cache<value_t, capacity, key_t>::replayer<Ts...>
+  ::registered = cache_manifest::register_replay(
+      replayer<Ts...>::signature(), &replayer<Ts...>::replay,
+      &computation_cache<value_t, capacity, key_t>::is_shared);
+
+// Possible better performance, but use inside class scope only (private).
+// The iterator stays alive to the end of scope, a shared cache instance is
+// checked out until then.
 #define fetch_or_create_m(op, key, ...)  \
     auto it = find(key);  \
-    auto op = it == end() ? fetch(create(key, __VA_ARGS__)) : fetch(it);
+    if (it == end())  \
+      it = create(key, __VA_ARGS__);  \
+    auto op = fetch(it);
 
 template <typename T>
 inline std::string to_string(const T arg) {
@@ -456,9 +1373,42 @@ inline bytestring to_bytes(T&& arg, Ts&&... args) {
   return bytes;
 }
 
+inline void hash_to(hasher &h, const tensor &arg) {
+  auto arg_desc = arg.get_mkldnn_memory_desc_t();
+  h.update(arg_desc->ndims);
+  for (int i = 0; i < arg_desc->ndims; i++) {
+    h.update(static_cast<uint64_t>(arg_desc->layout_desc.blocking.strides[0][i]));
+    h.update(static_cast<uint64_t>(arg_desc->layout_desc.blocking.strides[1][i]));
+    hash_to(h, arg_desc->layout_desc.blocking.block_dims[i]);
+    hash_to(h, arg_desc->layout_desc.blocking.padding_dims[i]);
+    hash_to(h, arg_desc->layout_desc.blocking.offset_padding_to_data[i]);
+    hash_to(h, arg_desc->dims[i]);
+  }
+  h.update(static_cast<uint64_t>(arg_desc->layout_desc.blocking.offset_padding));
+  hash_to(h, arg_desc->data_type);
+  hash_to(h, arg_desc->format);
+}
+
+inline void hash_args(hasher &h) {}
+
+template <typename T, typename ...Ts>
+inline void hash_args(hasher &h, T&& arg, Ts&&... args) {
+  hash_to(h, std::forward<T>(arg));
+  hash_args(h, std::forward<Ts>(args)...);
+}
+
+// Arguments are read twice when keys are verified, never moved from
 template <typename ...Ts>
-inline key_t create_key(Ts&&... args) {
-  return to_bytes(std::forward<Ts>(args)...);
+inline key_t create_key(const Ts&... args) {
+  hasher h;
+  hash_args(h, args...);
+
+  key_t key;
+  h.finalize(key.lo, key.hi);
+#ifdef IDEEP_VERIFY_CACHE_KEY
+  key.bytes = to_bytes(args...);
+#endif
+  return key;
 }
 
 }
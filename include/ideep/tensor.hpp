@@ -259,6 +259,23 @@ public:
       return any;
     }
 
+    /// Returns a memory descriptor for an activation of a primitive, the
+    /// channels-last layout in that mode, otherwise format any.
+    mkldnn_memory_desc_t format_activation() const {
+      const mkldnn_memory_desc_t *origin = get_mkldnn_memory_desc_t();
+      if (!engine::channels_last() || (origin->ndims != 4 && origin->ndims != 5))
+        return format_any();
+
+      mkldnn_memory_desc_t plain;
+      error::wrap_c_api(
+          mkldnn_memory_desc_init(&plain, origin->ndims,
+            origin->dims, origin->data_type,
+            convert_to_c(engine::default_format(origin->ndims))),
+          "could not initialize a memory descriptor");
+
+      return plain;
+    }
+
     /// Returns a new descriptor which had same dimension and data type
     /// but different public format.
     /// Format protocol:
@@ -377,12 +394,12 @@ public:
       case mkldnn_chwn:
       case mkldnn_nChw8c:
       case mkldnn_nChw16c:
-        ret = format::nchw;
+        ret = engine::default_format(4);
         break;
       case mkldnn_ncdhw:
       case mkldnn_ndhwc:
       case mkldnn_nCdhw16c:
-        ret = format::ncdhw;
+        ret = engine::default_format(5);
         break;
       case mkldnn_oihw:
       case mkldnn_ihwo:
@@ -1282,17 +1299,26 @@ public:
     if (!get_descriptor().is_shape_compatible(new_dims)) {
       throw error(mkldnn_runtime_error, "reshape to incompatible shape");
     } else if (new_dims != get_dims()) {
-      if (!is_public_format()) {
+      // Reshape keeps the row-major order of the logical dims, which a
+      // channels-last tensor is not in
+      auto channels_last = engine::channels_last();
+      if (!is_public_format() || (channels_last
+            && get_internal_format() != engine::plain_format(ndims()))) {
         utils::computation_web::template parameter<tensor>::
             computation_param_materialize(*this);
         tensor p;
-        p.init<alloc, computation_t>({get_dims(), get_data_type()});
+        p.init<alloc, computation_t>(
+            {get_dims(), get_data_type(), engine::plain_format(ndims())});
         reorder_to(p);
         set_data_handle(p.get_data_handle());
         set_tensor_buffer(p.get_tensor_buffer());
       }
 
-      set_descriptor({new_dims, get_data_type()});
+      if (channels_last)
+        set_descriptor({new_dims, get_data_type(),
+            engine::plain_format((int)new_dims.size())});
+      else
+        set_descriptor({new_dims, get_data_type()});
     }
 
     return *this;
@@ -1322,10 +1348,17 @@ public:
     if (Y_dims != this->get_dims()) {
       this->set_descriptor(src.get_descriptor().reshape(Y_dims));
     }
+    // Both sides are walked in nchw order below
+    if (get_internal_format() == format::nhwc)
+      this->set_descriptor({Y_dims, get_data_type(), format::nchw});
 
     tensor tmp;
     const float* Xdata;
-    if (!src.is_public_format()){
+    if (engine::channels_last() && src.get_internal_format() != format::nchw) {
+      tmp.init({src_dims, src.get_data_type(), format::nchw});
+      src.reorder_to(tmp);
+      Xdata = static_cast<float*>(tmp.get_data_handle());
+    } else if (!src.is_public_format()){
       tmp = src.to_public();
       Xdata = static_cast<float*>(tmp.get_data_handle());
     } else {
@@ -1468,9 +1501,66 @@ public:
     return true;
   }
 
+  /// Size of the buffer the lazy memory planner may share, 0 for views and
+  /// tensors with an extra buffer
+  size_t computation_param_size() const {
+    if (has_extra() || get_tensor_buffer().get() == nullptr ||
+        get_tensor_buffer().get() != get_data_handle<false>())
+      return 0;
+    return get_size();
+  }
+
+  std::shared_ptr<char> computation_param_buffer() const {
+    return get_tensor_buffer();
+  }
+
+  void computation_param_rebind(const std::shared_ptr<char>& buffer) {
+    set_data_handle(buffer.get());
+    set_tensor_buffer(buffer);
+  }
+
+  std::vector<int> computation_param_dims() const {
+    return get_dims();
+  }
+
+  /// A tensor of its own sharing the buffer, for captured graphs
+  tensor computation_param_clone() const {
+    tensor clone(get_descriptor(), get_data_handle<false>());
+    clone.set_tensor_buffer(get_tensor_buffer());
+    clone.set_public_format(get_public_format());
+    if (has_scale())
+      clone.set_scale(get_scale());
+    if (has_extra())
+      clone.twin_ = std::make_shared<tensor>(
+          twin_->computation_param_clone());
+    return clone;
+  }
+
+  /// Point at the buffer of t, used when a captured graph is replayed
+  void computation_param_attach(const tensor& t) {
+    set_data_handle(t.get_data_handle<false>());
+    set_tensor_buffer(t.get_tensor_buffer());
+    if (t.has_scale())
+      set_scale(t.get_scale());
+    if (has_extra() && t.has_extra())
+      twin_->computation_param_attach(*t.get_extra());
+  }
+
+  bool computation_param_compatible(const tensor& t) const {
+    return get_descriptor() == t.get_descriptor();
+  }
+
   scale_t calculate_scale(data_type adata_type, int axis = -1) const {
     if (has_scale()) return get_scale();
     auto atensor = (is_public_format()) ? *this : to_public();
+    if (axis != -1 && (atensor.get_internal_format() == format::nhwc
+          || atensor.get_internal_format() == format::ndhwc)) {
+      // Scales along an axis walk the buffer in the order of logical dims
+      tensor plain;
+      plain.init({get_dims(), get_data_type(), engine::plain_format(ndims())});
+      atensor.reorder_to(plain);
+      atensor = plain;
+    }
     auto *data_buffer = static_cast<float*>(atensor.get_data_handle());
     auto scale_filler = [=](scale_t &scales) {
       if (adata_type != data_type::f32 && !scales.empty()) {
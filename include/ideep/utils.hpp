@@ -3,6 +3,9 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #ifdef _OPENMP
 #include <omp.h>
 #else
@@ -133,6 +136,129 @@ inline bytestring to_bytes(const T arg) {
   return arg.to_bytes();
 }
 
+/// Incremental 128-bit hash (MurmurHash3 x64_128 block mixing) over
+/// 64-bit words. Keeps no heap state so keys can be built on hot paths.
+class hasher {
+public:
+  hasher() : h1_(seed1), h2_(seed2), pending_(0), npending_(0), nwords_(0) {}
+
+  void update(uint64_t word) {
+    nwords_ ++;
+    if (npending_ == 0) {
+      pending_ = word;
+      npending_ = 1;
+      return;
+    }
+
+    mix_block(pending_, word);
+    npending_ = 0;
+  }
+
+  void finalize(uint64_t &lo, uint64_t &hi) const {
+    uint64_t h1 = h1_, h2 = h2_;
+    if (npending_ != 0) {
+      uint64_t k1 = pending_;
+      k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= nwords_; h2 ^= nwords_;
+    h1 += h2; h2 += h1;
+    h1 = fmix(h1); h2 = fmix(h2);
+    h1 += h2; h2 += h1;
+    lo = h1; hi = h2;
+  }
+
+private:
+  static constexpr uint64_t seed1 = 0x9e3779b97f4a7c15ULL;
+  static constexpr uint64_t seed2 = 0x243f6a8885a308d3ULL;
+  static constexpr uint64_t c1 = 0x87c37b91114253d5ULL;
+  static constexpr uint64_t c2 = 0x4cf5ad432745937fULL;
+
+  static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+  }
+
+  static inline uint64_t fmix(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+  }
+
+  inline void mix_block(uint64_t k1, uint64_t k2) {
+    k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1_ ^= k1;
+    h1_ = rotl(h1_, 27); h1_ += h2_; h1_ = h1_ * 5 + 0x52dce729;
+    k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2_ ^= k2;
+    h2_ = rotl(h2_, 31); h2_ += h1_; h2_ = h2_ * 5 + 0x38495ab5;
+  }
+
+  uint64_t h1_, h2_;
+  uint64_t pending_;
+  int npending_;
+  uint64_t nwords_;
+};
+
+/// Fixed-size primitive cache key. A default constructed key is empty,
+/// which op interfaces use as "not computed yet".
+///
+/// Define IDEEP_VERIFY_CACHE_KEY to keep the serialized bytes next to the
+/// hash, caches then verify equal hashes come from equal bytes.
+struct hash_key {
+  uint64_t lo, hi;
+#ifdef IDEEP_VERIFY_CACHE_KEY
+  bytestring bytes;
+#endif
+
+  hash_key() : lo(0), hi(0) {}
+
+  bool empty() const {
+    return lo == 0 && hi == 0;
+  }
+
+  bool operator==(const hash_key &other) const {
+    return lo == other.lo && hi == other.hi;
+  }
+
+  bool operator!=(const hash_key &other) const {
+    return !(*this == other);
+  }
+};
+
+inline void hash_to(hasher &h, const int arg) {
+  h.update(static_cast<uint32_t>(arg));
+}
+
+inline void hash_to(hasher &h, const float arg) {
+  uint32_t bits;
+  std::memcpy(&bits, &arg, sizeof(bits));
+  h.update(bits);
+}
+
+inline void hash_to(hasher &h, const uint64_t arg) {
+  h.update(arg);
+}
+
+template <typename T, typename =
+  typename std::enable_if<std::is_enum<T>::value>::type>
+inline void hash_to(hasher &h, T arg) {
+  h.update(static_cast<uint64_t>(arg));
+}
+
+template <typename T, typename =
+  typename std::enable_if< std::is_class<T>::value>::type, typename = void>
+inline void hash_to(hasher &h, const T &arg) {
+  arg.hash_to(h);
+}
+
+template <typename T>
+inline void hash_to(hasher &h, const std::vector<T> &arg) {
+  h.update(arg.size());
+  for (const auto &elems : arg)
+    hash_to(h, elems);
+}
+
 enum algorithm {
   F_UNDEF = 0,
   F_CONV_FWD,
@@ -242,4 +368,13 @@ inline void fast_memset(data_type_t *data_o, data_type_t val, size_t len)
 
 }
 }
+
+namespace std {
+template <>
+struct hash<ideep::utils::hash_key> {
+  size_t operator()(const ideep::utils::hash_key &key) const {
+    return static_cast<size_t>(key.lo ^ key.hi);
+  }
+};
+}
 #endif
@@ -31,8 +31,21 @@
 #include <chrono>
 #include <atomic>
 #include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <condition_variable>
 #include <functional>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <cstdlib>
+#include <algorithm>
+#include <exception>
 #include <assert.h>
+#include <typeinfo>
+#ifdef __GNUG__
+#include <cxxabi.h>
+#endif
 #include "utils.hpp"
 
 #ifdef _DBG_
@@ -50,6 +63,10 @@ public:
 
   template<typename param_t> class node;
   template<typename param_t> class _node;
+  template<typename param_t> class session;
+
+  // Materialized status, shared among the copies of a parameter
+  typedef std::atomic<bool> flag_t;
 
 public:
 #if _IDEEP4PY_WEB_OPT_ == true
@@ -57,7 +74,7 @@ public:
   class parameter {
   public:
     parameter() :
-        materialized_(std::make_shared<bool>(true)), creator_(nullptr),
+        materialized_(std::make_shared<flag_t>(true)), creator_(nullptr),
         opts_(std::make_shared<std::vector<param_t>>(std::vector<param_t> {})) {}
     parameter(const parameter& t) :
         materialized_(t.get_materialized()), creator_(t.creator()),
@@ -66,6 +83,14 @@ public:
     using cn_t = typename utils::computation_web::node<param_t>::cn_t;
 
     static void computation_param_materialize(const param_t& t) {
+      // Deps of a firing node are computed before it, and on the async
+      // worker waiting would block on the job being run
+      if (firing())
+        return;
+      if (computation_web::template async_executor<param_t>::wait(t, true))
+        return;
+      // Acquire pairs with the release in fire(), the data is visible
+      // without taking the creator session's lock
       if (t.is_materialized())
         return;
       computation_web::template executor<param_t>::trigger_evaluation(t);
@@ -73,10 +98,18 @@ public:
     }
 
   public:
-    inline void unmark_materialized() { *materialized_.get() = false; }
-    inline void mark_materialized() { *materialized_.get() = true; }
-    inline bool is_materialized() const { return *materialized_.get(); }
-    inline std::shared_ptr<bool> get_materialized() const { return materialized_; }
+    inline void unmark_materialized() {
+      materialized_->store(false, std::memory_order_release);
+    }
+    inline void mark_materialized() {
+      materialized_->store(true, std::memory_order_release);
+    }
+    inline bool is_materialized() const {
+      return materialized_->load(std::memory_order_acquire);
+    }
+    inline std::shared_ptr<flag_t> get_materialized() const {
+      return materialized_;
+    }
 
     inline bool computation_param_is_same(const parameter& t) const {
       return t.get_materialized().get() == materialized_.get() &&
@@ -94,9 +127,19 @@ public:
 
     virtual bool computation_param_own_of_memory() const { return false; }
 
+    // Buffer hooks of the memory planner, size 0 keeps the buffer in place
+    virtual size_t computation_param_size() const { return 0; }
+    virtual std::shared_ptr<char> computation_param_buffer() const {
+      return nullptr;
+    }
+    virtual void computation_param_rebind(const std::shared_ptr<char>&) {}
+
+    // Dims shown in traces
+    virtual std::vector<int> computation_param_dims() const { return {}; }
+
   private:
     // share materialized status among tensors
-    std::shared_ptr<bool> materialized_;
+    std::shared_ptr<flag_t> materialized_;
     cn_t creator_;
     std::shared_ptr<std::vector<param_t>> opts_;
   };
@@ -114,7 +157,7 @@ public:
     inline void unmark_materialized() { return; }
     inline void mark_materialized() { return; }
     inline bool is_materialized() const { return false; }
-    inline std::shared_ptr<bool> get_materialized() const { return std::make_shared<bool>(false); }
+    inline std::shared_ptr<flag_t> get_materialized() const { return std::make_shared<flag_t>(false); }
 
     inline bool computation_param_is_same(const parameter& t) const {
       return false;
@@ -130,9 +173,327 @@ public:
     inline bool has_opts() const { return false; }
 
     bool computation_param_own_of_memory() const { return false; }
+
+    size_t computation_param_size() const { return 0; }
+    std::shared_ptr<char> computation_param_buffer() const { return nullptr; }
+    void computation_param_rebind(const std::shared_ptr<char>&) {}
+
+    std::vector<int> computation_param_dims() const { return {}; }
   };
 #endif
 
+  /// Whether the calling thread is computing a node of the web
+  static bool& firing() {
+    static thread_local bool firing_ = false;
+    return firing_;
+  }
+
+  /// Free blocks kept per thread by the pools below, block_t links
+  /// through next and next_batch. A list past max_cached hands a batch to
+  /// a depot shared by all threads, and an empty list takes one back, so
+  /// blocks freed on another thread, such as the async worker, return to
+  /// the threads allocating them. Batches are pushed with a CAS and taken
+  /// all at once with an exchange, so the depot is lock-free and immune
+  /// to ABA.
+  template<typename block_t, typename deleter_t>
+  class free_list {
+  public:
+    /// A cached block, or nullptr
+    static block_t *pop() {
+      auto& list = local();
+      if (list.head == nullptr && !refill(list))
+        return nullptr;
+      auto b = list.head;
+      list.head = b->next;
+      list.size --;
+      return b;
+    }
+
+    static void push(block_t *b) {
+      auto& list = local();
+      if (list.closed) {
+        deleter_t()(b);
+        return;
+      }
+      if (list.size >= max_cached)
+        spill(list);
+      b->next = list.head;
+      list.head = b;
+      list.size ++;
+    }
+
+  private:
+    static constexpr size_t max_cached = 1024;
+    static constexpr size_t batch = 256;
+    static constexpr size_t max_batches = 64;
+
+    // Trivial, so that objects freed late in thread exit still find it
+    struct list_t {
+      block_t *head;
+      size_t size;
+      bool closed;
+    };
+
+    struct closer {
+      explicit closer(list_t *list) : list_(list) {}
+      ~closer() {
+        list_->closed = true;
+        while (list_->head != nullptr) {
+          auto next = list_->head->next;
+          deleter_t()(list_->head);
+          list_->head = next;
+        }
+      }
+      list_t *list_;
+    };
+
+    static list_t& local() {
+      static thread_local list_t list_ = {nullptr, 0, false};
+      static thread_local closer closer_(&list_);
+      (void)closer_;
+      return list_;
+    }
+
+    // Batches chained through the next_batch of their first block
+    struct depot_t {
+      std::atomic<block_t *> head;
+      std::atomic<size_t> batches;
+    };
+
+    static depot_t& depot() {
+      static depot_t depot_ = {{nullptr}, {0}};
+      return depot_;
+    }
+
+    // Put the batches first to last on top of the depot
+    static void push_batches(block_t *first, block_t *last) {
+      auto& d = depot();
+      last->next_batch = d.head.load(std::memory_order_relaxed);
+      while (!d.head.compare_exchange_weak(last->next_batch, first,
+          std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // Move the batch most recently freed off the list, into the depot
+    // unless it is full
+    static void spill(list_t& list) {
+      auto first = list.head;
+      auto last = first;
+      for (size_t i = 1; i < batch; i++)
+        last = last->next;
+      list.head = last->next;
+      list.size -= batch;
+      last->next = nullptr;
+
+      auto& d = depot();
+      if (d.batches.fetch_add(1, std::memory_order_relaxed) >= max_batches) {
+        d.batches.fetch_sub(1, std::memory_order_relaxed);
+        while (first != nullptr) {
+          auto next = first->next;
+          deleter_t()(first);
+          first = next;
+        }
+        return;
+      }
+      push_batches(first, first);
+    }
+
+    // Take one batch out of the depot, putting the others back
+    static bool refill(list_t& list) {
+      auto& d = depot();
+      if (d.head.load(std::memory_order_relaxed) == nullptr)
+        return false;
+      auto taken = d.head.exchange(nullptr, std::memory_order_acquire);
+      if (taken == nullptr)
+        return false;
+      d.batches.fetch_sub(1, std::memory_order_relaxed);
+      if (auto rest = taken->next_batch) {
+        auto last = rest;
+        while (last->next_batch != nullptr)
+          last = last->next_batch;
+        push_batches(rest, last);
+      }
+      list.head = taken;
+      list.size = batch;
+      return true;
+    }
+  };
+
+  /// Allocator handing out single objects from a per thread free list,
+  /// used for nodes and computation copies enqueued on every op
+  template<typename T>
+  class pool_allocator {
+  public:
+    typedef T value_type;
+
+    pool_allocator() = default;
+    template<typename U> pool_allocator(const pool_allocator<U>&) {}
+
+    T *allocate(size_t n) {
+      block *b = n == 1 ? blocks::pop() : nullptr;
+      if (b == nullptr)
+        return static_cast<T *>(::operator new(
+            n == 1 ? std::max(sizeof(T), sizeof(block)) : n * sizeof(T)));
+      return reinterpret_cast<T *>(b);
+    }
+
+    void deallocate(T *p, size_t n) {
+      if (n != 1) {
+        ::operator delete(p);
+        return;
+      }
+      blocks::push(reinterpret_cast<block *>(p));
+    }
+
+    template<typename U>
+    bool operator ==(const pool_allocator<U>&) const { return true; }
+    template<typename U>
+    bool operator !=(const pool_allocator<U>&) const { return false; }
+
+  private:
+    struct block { block *next; block *next_batch; };
+
+    struct deleter {
+      void operator()(block *b) const { ::operator delete(b); }
+    };
+
+    typedef free_list<block, deleter> blocks;
+  };
+
+  /// Timeline of fired nodes. When enabled every fire records its
+  /// computation, the dims it read and wrote, whether it came out of
+  /// fusion, its thread and start and end time. dump() writes the events
+  /// in Chrome trace format, to be opened in chrome://tracing or Perfetto.
+  template<typename param_t>
+  class tracer {
+  public:
+    struct event {
+      const char *type;  // mangled type name of the computation
+      std::string dims;
+      bool fused;
+      size_t thread;
+      long long begin;   // microseconds since the first trace
+      long long end;
+    };
+
+    // WEB_TRACE=1 records, any other value is also the file written at exit
+    static bool is_enabled() {
+      return state().enabled;
+    }
+
+    static void set_enabled(bool on) {
+      state().enabled = on;
+    }
+
+    static long long now() {
+      return std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - state().start).count();
+    }
+
+    static void record(const char *type, bool fused,
+        const std::vector<param_t>& deps, const std::vector<param_t>& tars,
+        long long begin) {
+      event e {type, dims_of(deps) + " -> " + dims_of(tars), fused,
+          thread_id(), begin, now()};
+      auto& s = state();
+      std::lock_guard<std::mutex> lock(s.mutex);
+      s.events.push_back(std::move(e));
+    }
+
+    static std::vector<event> events() {
+      auto& s = state();
+      std::lock_guard<std::mutex> lock(s.mutex);
+      return s.events;
+    }
+
+    static void clear() {
+      auto& s = state();
+      std::lock_guard<std::mutex> lock(s.mutex);
+      s.events.clear();
+    }
+
+    static void dump(std::ostream& os) {
+      auto all = events();
+      os << "{\"traceEvents\":[";
+      for (size_t i = 0; i < all.size(); i++) {
+        auto& e = all[i];
+        os << (i ? ",\n" : "\n")
+           << "{\"name\":\"" << type_name(e.type)
+           << "\",\"cat\":\"web\",\"ph\":\"X\",\"pid\":0"
+           << ",\"tid\":" << e.thread << ",\"ts\":" << e.begin
+           << ",\"dur\":" << e.end - e.begin
+           << ",\"args\":{\"dims\":\"" << e.dims
+           << "\",\"fused\":" << (e.fused ? "true" : "false") << "}}";
+      }
+      os << "\n]}\n";
+    }
+
+    /// Write the trace to path, false when it can not be opened
+    static bool dump(const std::string& path) {
+      std::ofstream os(path);
+      if (!os)
+        return false;
+      dump(os);
+      return os.good();
+    }
+
+    /// Demangled type name, without the namespace
+    static std::string type_name(const char *mangled) {
+      std::string name = mangled;
+#ifdef __GNUG__
+      int status = 0;
+      char *demangled = abi::__cxa_demangle(mangled, nullptr, nullptr, &status);
+      if (status == 0 && demangled != nullptr)
+        name = demangled;
+      free(demangled);
+#endif
+      auto pos = name.rfind("::");
+      return pos == std::string::npos ? name : name.substr(pos + 2);
+    }
+
+  private:
+    struct state_t {
+      state_t() : start(std::chrono::steady_clock::now()) {
+        const char *env = getenv("WEB_TRACE");
+        enabled = env != nullptr && *env != '0';
+        if (enabled && std::string(env) != "1")
+          path = env;
+      }
+
+      ~state_t() {
+        if (!path.empty())
+          dump(path);
+      }
+
+      bool enabled;
+      std::string path;
+      std::chrono::steady_clock::time_point start;
+      std::mutex mutex;
+      std::vector<event> events;
+    };
+
+    static state_t& state() {
+      static state_t state_;
+      return state_;
+    }
+
+    static size_t thread_id() {
+      static std::atomic<size_t> next {0};
+      static thread_local size_t id = next ++;
+      return id;
+    }
+
+    static std::string dims_of(const std::vector<param_t>& params) {
+      std::ostringstream os;
+      for (size_t i = 0; i < params.size(); i++) {
+        os << (i ? " " : "");
+        auto dims = params[i].computation_param_dims();
+        for (size_t j = 0; j < dims.size(); j++)
+          os << (j ? "x" : "") << dims[j];
+      }
+      return os.str();
+    }
+  };
+
   template<typename param_t>
   class node {
   public:
@@ -168,12 +529,19 @@ public:
         std::shared_ptr<node<param_t>>, fusion_attr_t&, param_t&) {
       return nullptr;
     }
+
+    // Whether the first target may share the buffer of the first dep
+    virtual bool can_compute_inplace() const { return false; }
+
+    // Whether this computes weight gradients, which nothing on the data
+    // gradient path reads
+    virtual bool computes_weight_gradient() const { return false; }
   };
 
   template<typename param_t>
   class _node {
   public:
-    _node() : successor_(nullptr) {}
+    _node() : successor_(nullptr), fused_(false) {}
 
     typedef typename std::shared_ptr<_node<param_t>> cn_t;
     using fusion_attr_t = typename node<param_t>::fusion_attr_t;
@@ -217,8 +585,29 @@ public:
     virtual void set_scattered() {}
     virtual bool scattered() { return true; }
 
+    virtual bool inplace() { return false; }
+    virtual bool weight_gradient() { return false; }
+
+    // Whether the dag optimizer made this node out of a pair
+    bool fused() const { return fused_; }
+    void set_fused() { fused_ = true; }
+
+    virtual std::shared_ptr<node<param_t>> comp() { return nullptr; }
+
+    // State the copies of one cached computation share, its primitive,
+    // nullptr if none. Firing binds it to the tensors of the node, so
+    // nodes holding the same state must not fire concurrently.
+    virtual const void *shared_state() { return nullptr; }
+
+    std::weak_ptr<session<param_t>> get_session() { return session_; }
+    void set_session(const std::weak_ptr<session<param_t>>& s) {
+      session_ = s;
+    }
+
   private:
     cn_t successor_;
+    std::weak_ptr<session<param_t>> session_;
+    bool fused_;
   };
 
   template<typename comp_inst_t, typename param_t>
@@ -229,6 +618,9 @@ public:
     using fusion_type_t = typename node<param_t>::fusion_type_t;
     using prop_kind_t = typename node<param_t>::prop_kind_t;
 
+    // Deps and targets of a node. Released ones are kept on free lists
+    // with their vectors' capacity, so steady state enqueues don't
+    // allocate.
     class computation_param {
     public:
       computation_param() = default;
@@ -238,7 +630,31 @@ public:
 
       void clear() { deps_.clear(); tars_.clear(); }
 
+      struct release {
+        void operator()(computation_param *p) const {
+          p->clear();
+          params::push(p);
+        }
+      };
+
+      typedef std::unique_ptr<computation_param, release> ptr_t;
+
+      static ptr_t acquire() {
+        auto p = params::pop();
+        return ptr_t(p != nullptr ? p : new computation_param());
+      }
+
+      // Links while on a free list
+      computation_param *next = nullptr;
+      computation_param *next_batch = nullptr;
+
     private:
+      struct deleter {
+        void operator()(computation_param *p) const { delete p; }
+      };
+
+      typedef free_list<computation_param, deleter> params;
+
       std::vector<param_t> deps_;
       std::vector<param_t> tars_;
     };
@@ -246,16 +662,17 @@ public:
   public:
     computation_node(comp_inst_t& inst, prop_kind_t pkind,
         fusion_attr_t fattr = { fusion_type_t::CN_FUSION_NA, {}, {} }) :
-        comp_(std::make_shared<comp_inst_t>(inst)),
-        params_(std::make_shared<computation_param>(computation_param())),
-        fattr_(std::make_shared<fusion_attr_t>(fattr)),
+        comp_(std::allocate_shared<comp_inst_t>(
+            pool_allocator<comp_inst_t>(), inst)),
+        params_(computation_param::acquire()),
+        fattr_(std::move(fattr)),
         pkind_(pkind), scattered_(false) {}
 
     computation_node(std::shared_ptr<node<param_t>>& inst_ptr, prop_kind_t pkind,
         fusion_attr_t fattr = { fusion_type_t::CN_FUSION_NA, {}, {} }) :
         comp_(inst_ptr),
-        params_(std::make_shared<computation_param>(computation_param())),
-        fattr_(std::make_shared<fusion_attr_t>(fattr)),
+        params_(computation_param::acquire()),
+        fattr_(std::move(fattr)),
         pkind_(pkind), scattered_(false) {}
 
     ~computation_node() {
@@ -267,8 +684,9 @@ public:
     static std::shared_ptr<computation_node<comp_inst_t, param_t>>
     create(comp_inst_t& comp_inst, prop_kind_t pkind, params_t&... comp_tars) {
       fusion_attr_t fattr = { fusion_type_t::CN_FUSION_NA, {}, {} };
-      auto cn = std::make_shared<computation_node<comp_inst_t, param_t>>(
-          computation_node<comp_inst_t, param_t>(comp_inst, pkind, fattr));
+      auto cn = std::allocate_shared<computation_node<comp_inst_t, param_t>>(
+          pool_allocator<computation_node<comp_inst_t, param_t>>(),
+          comp_inst, pkind, fattr);
       DBG("Create cn 0x%llx %s %d\n", (unsigned long long)cn.get(), typeid(cn).name(),
           cn->prop_kind());
       auto success = cn->bind(cn, comp_tars...);
@@ -280,8 +698,9 @@ public:
     static std::shared_ptr<computation_node<comp_inst_t, param_t>>
     create(comp_inst_t& comp_inst, prop_kind_t pkind,
         fusion_attr_t fattr, params_t&... comp_tars) {
-      auto cn = std::make_shared<computation_node<comp_inst_t, param_t>>(
-          computation_node<comp_inst_t, param_t>(comp_inst, pkind, fattr));
+      auto cn = std::allocate_shared<computation_node<comp_inst_t, param_t>>(
+          pool_allocator<computation_node<comp_inst_t, param_t>>(),
+          comp_inst, pkind, fattr);
       DBG("Create cn 0x%llx %s %d\n", (unsigned long long)cn.get(), typeid(cn).name(),
           cn->prop_kind());
       auto success = cn->bind(cn, comp_tars...);
@@ -294,8 +713,9 @@ public:
     create(std::shared_ptr<node<param_t>> comp_ptr,
         prop_kind_t pkind, params_t&... comp_tars) {
       fusion_attr_t fattr = { fusion_type_t::CN_FUSION_NA, {}, {} };
-      auto cn = std::make_shared<computation_node<comp_inst_t, param_t>>(
-          computation_node<comp_inst_t, param_t>(comp_ptr, pkind, fattr));
+      auto cn = std::allocate_shared<computation_node<comp_inst_t, param_t>>(
+          pool_allocator<computation_node<comp_inst_t, param_t>>(),
+          comp_ptr, pkind, fattr);
       DBG("Create cn 0x%llx %s %d\n", (unsigned long long)cn.get(), typeid(cn).name(),
           cn->prop_kind());
       auto success = cn->bind(cn, comp_tars...);
@@ -307,8 +727,9 @@ public:
     static std::shared_ptr<computation_node<comp_inst_t, param_t>>
     create(std::shared_ptr<node<param_t>> comp_ptr, prop_kind_t pkind,
         fusion_attr_t fattr, params_t&... comp_tars) {
-      auto cn = std::make_shared<computation_node<comp_inst_t, param_t>>(
-          computation_node<comp_inst_t, param_t>(comp_ptr, pkind, fattr));
+      auto cn = std::allocate_shared<computation_node<comp_inst_t, param_t>>(
+          pool_allocator<computation_node<comp_inst_t, param_t>>(),
+          comp_ptr, pkind, fattr);
       DBG("Create cn 0x%llx %s %s\n", (unsigned long long)cn.get(), typeid(cn).name(),
           cn->prop_kind());
       auto success = cn->bind(cn, comp_tars...);
@@ -318,7 +739,7 @@ public:
 
   public:
     bool build_deps(const param_t& dep) {
-      if (!check_or_clear(dep)) { return false; }
+      if (!check_or_clear(dep, deferrable())) { return false; }
       deps().push_back(dep);
       return true;
     }
@@ -333,7 +754,7 @@ public:
 
     template<typename ...params_t>
     bool build_deps(const param_t& dep, const params_t&... _deps) {
-      if (!check_or_clear(dep)) { return false; }
+      if (!check_or_clear(dep, deferrable())) { return false; }
       deps().push_back(dep);
       return build_deps(_deps...);
     }
@@ -341,6 +762,7 @@ public:
     bool bind(std::shared_ptr<computation_node<
         comp_inst_t, param_t>> cn, param_t& tar) {
       if (!check_or_clear(tar)) { return false; }
+      async_executor<param_t>::wait(tar);
       tar.unmark_materialized();
       tar.set_creator(cn);
       tars().push_back(tar);
@@ -356,6 +778,7 @@ public:
     bool bind(std::shared_ptr<computation_node<
         comp_inst_t, param_t>> cn, param_t& tar, params_t&... _tars) {
       if (!check_or_clear(tar)) { return false; }
+      async_executor<param_t>::wait(tar);
       tar.unmark_materialized();
       tar.set_creator(cn);
       tars().push_back(tar);
@@ -367,9 +790,10 @@ public:
       return bind(cn, _tars...);
     }
 
-    bool check_or_clear(const param_t& t) {
-      auto workable = t.computation_param_own_of_memory();
+    bool check_or_clear(const param_t& t, bool deferrable = true) {
+      auto workable = deferrable && t.computation_param_own_of_memory();
       if (!workable) {
+        graph<param_t>::interrupt();
         for (auto tar: tars()) {
           tar.mark_materialized();
           tar.reset_creator();
@@ -379,24 +803,40 @@ public:
       return workable;
     }
 
+    // A shared cache hands the primitive to the next thread as soon as the
+    // op returns, a deferred node would still be using it. Such ops compute
+    // eagerly.
+    static bool deferrable() { return !is_shared_cache<comp_inst_t>(0); }
+
     std::vector<param_t>& deps() { return params_->deps(); }
     std::vector<param_t>& tars() { return params_->tars(); }
 
-    fusion_attr_t& fusion_attr() { return *fattr_.get(); }
+    fusion_attr_t& fusion_attr() { return fattr_; }
 
   public:
     static void
     enqueue(std::shared_ptr<computation_node<comp_inst_t, param_t>> cn) {
       DBG("enqueue cn 0x%llx %s\n",
           (unsigned long long)cn.get(), typeid(cn).name());
-      computation_web::template executor<param_t>::lazy_evaluate(cn);
       cn->unset_scattered();
+      computation_web::template executor<param_t>::lazy_evaluate(cn);
     }
 
     void fire() {
+      bool traced = tracer<param_t>::is_enabled();
+      auto begin = traced ? tracer<param_t>::now() : 0;
+      struct firing_guard {
+        bool was_ = firing();
+        firing_guard() { firing() = true; }
+        ~firing_guard() { firing() = was_; }
+      } guard;
       comp_->fire_computation_node(deps(), tars());
       for (auto tar : tars())
         tar.mark_materialized();
+      if (traced) {
+        tracer<param_t>::record(typeid(comp_inst_t).name(),
+            this->fused(), deps(), tars(), begin);
+      }
     }
 
     cn_t fuse(cn_t cur) {
@@ -423,10 +863,37 @@ public:
     void unset_scattered() { scattered_ = false; }
     bool scattered() { return scattered_; }
 
+    bool inplace() { return comp_->can_compute_inplace(); }
+    bool weight_gradient() { return comp_->computes_weight_gradient(); }
+
+    std::shared_ptr<node<param_t>> comp() { return comp_; }
+
+    const void *shared_state() {
+      auto comp = dynamic_cast<comp_inst_t *>(comp_.get());
+      return comp != nullptr ? state_of<comp_inst_t>(comp, 0) : nullptr;
+    }
+
   private:
+    template <typename T>
+    static auto state_of(T *comp, int)
+        -> decltype(static_cast<const void *>(comp->get())) {
+      return comp->get();
+    }
+
+    template <typename T>
+    static const void *state_of(T *, ...) { return nullptr; }
+
+    template <typename T>
+    static auto is_shared_cache(int) -> decltype(T::is_shared()) {
+      return T::is_shared();
+    }
+
+    template <typename T>
+    static bool is_shared_cache(...) { return false; }
+
     std::shared_ptr<node<param_t>> comp_;
-    std::shared_ptr<computation_param> params_;
-    std::shared_ptr<fusion_attr_t> fattr_;
+    typename computation_param::ptr_t params_;
+    fusion_attr_t fattr_;
     prop_kind_t pkind_;
     bool scattered_;
   };
@@ -438,46 +905,68 @@ public:
     using prop_kind_t = typename node<param_t>::prop_kind_t;
 
     static void lazy_evaluate(cn_t n) {
+      auto s = session<param_t>::current();
+
+      // Pending tensors of other sessions are computed there first, dags
+      // never span sessions
+      for (auto& dep : n->deps()) {
+        auto creator = dep.creator();
+        if (creator.get() != nullptr &&
+            creator->get_session().lock().get() != s)
+          parameter<param_t>::computation_param_materialize(dep);
+      }
+
+      std::lock_guard<std::recursive_mutex> lock(s->mutex());
+      n->set_session(s->shared_from_this());
       dag_build<param_t>::build_dag(n);
+      async_executor<param_t>::enqueued();
       return;
     }
 
     static void trigger_evaluation(const param_t& t) {
+      // Evaluate in the session t was created in
+      auto s = t.creator().get() != nullptr ?
+          t.creator()->get_session().lock() : nullptr;
+      typename session<param_t>::scope bind(s.get() != nullptr ?
+          s.get() : session<param_t>::current());
+      std::lock_guard<std::recursive_mutex> lock(
+          session<param_t>::current()->mutex());
+
+      // Checked again under the lock, another thread may have computed t
+      if (t.is_materialized())
+        return;
+
+      if (async_executor<param_t>::is_enabled()) {
+        async_executor<param_t>::evaluate(t);
+        return;
+      }
+
       auto d = dag_build<param_t>::fetch_dag(t);
       if (d.get() == nullptr)
         return;
 
+      // Dags left from the previous direction finish along with d, so do
+      // weight gradients when going backward, which then overlap with the
+      // data gradient path
+      std::vector<std::shared_ptr<dag<param_t>>> side;
       prop_kind_t pre_pkind;
       if (prop_kind_change(d->prop_kind(), pre_pkind)) {
-        // keep previous prop kind
-        do {
-          auto residue = dag_build<param_t>::fetch_dag(pre_pkind);
-          if (residue.get() == nullptr)
-            break;
-          parameter<param_t>::computation_param_materialize(
-             residue->target_tensors().at(0));
-        } while (true);
-
-        // set current prop kind
+        side = dag_build<param_t>::dags_of(pre_pkind);
         prop_kind_set(d->prop_kind());
       }
+      if (d->prop_kind() == prop_kind_t::CN_PROP_BACKWARD &&
+          dag_scheduler<param_t>::is_enabled()) {
+        auto grads = dag_build<param_t>::weight_gradient_dags();
+        side.insert(side.end(), grads.begin(), grads.end());
+      }
 
-      // Execute dependent dag before d
-      auto d_deps = d->get_deps();
-      for (auto dd : d_deps)
-        parameter<param_t>::computation_param_materialize(dd);
-
-      // Try optimize dag, then run it
-      // dag_optimizer<param_t>::optimize(d);
-      d->execute();
-
-      dag_build<param_t>::remove_dag(d);
+      // Execute dependent dags before d, independent ones concurrently
+      dag_scheduler<param_t>::run(d, side);
       return;
     }
 
     static prop_kind_t& prop_kind() {
-      static prop_kind_t cur_pkind = prop_kind_t::CN_PROP_NA;
-      return cur_pkind;
+      return session<param_t>::current()->pkind_;
     }
 
     static void prop_kind_set(prop_kind_t pkind) {
@@ -486,7 +975,7 @@ public:
     }
 
     static bool prop_kind_change(prop_kind_t pkind, prop_kind_t& _pre_pkind) {
-      static bool stat_init = false;
+      bool& stat_init = session<param_t>::current()->pkind_init_;
       prop_kind_t& pre_pkind = prop_kind();
       if (stat_init == false) {
         if (pkind != prop_kind_t::CN_PROP_NA) {
@@ -568,12 +1057,14 @@ public:
       #endif
         for (auto dep : cn->deps()) {
           if (dep.creator().get() != nullptr && dep.creator()->scattered()) {
+            graph<param_t>::record(dep.creator());
             dep.creator()->fire();
             dep.creator()->clear();
             DBG("fire scattered cn 0x%llx\n",
                 (unsigned long long)dep.creator().get());
           }
         }
+        graph<param_t>::record(cn);
         cn->fire(); cn->clear();
       }
       return;
@@ -605,19 +1096,26 @@ public:
     typedef typename std::shared_ptr<dag<param_t>> dag_t;
 
     static void build_dag(cn_t& n) {
+      // Weight gradients branch off, the data gradient chain keeps going
+      if (n->weight_gradient()) {
+        auto new_dag = std::make_shared<dag<param_t>>(dag<param_t>());
+        new_dag->build(n);
+        add_dag(new_dag);
+        return;
+      }
+
       auto deps = n->deps();
       std::vector<dag_t> related_dags;
-      for (auto d : dags()) {
-        for (auto i : deps) {
-          if (d->is_associated(i)) {
-            bool included = false;
-            for (auto rd : related_dags)
-              if (d.get() == rd.get())
-                included = true;
-            if (included == false)
-              related_dags.push_back(d);
-          }
-        }
+      for (auto i : deps) {
+        auto d = owner(i.creator());
+        if (d.get() == nullptr)
+          continue;
+        bool included = false;
+        for (auto rd : related_dags)
+          if (d.get() == rd.get())
+            included = true;
+        if (included == false)
+          related_dags.push_back(d);
       }
 
       DBG("build dag related_dags %d\n", (int)related_dags.size());
@@ -648,6 +1146,7 @@ public:
         if (related_cns.size() == 1 &&
             related_cns[0]->successor().get() == nullptr) {
           d->build(n);
+          index()[n.get()] = d;
           DBG("build dag case-1 dag (%d)\n", (int)dag_build<param_t>::dags().size());
           return;
         // case-2 (expand): node associated to middle node and the ending node of the dag
@@ -655,6 +1154,7 @@ public:
           for (auto rc : related_cns) {
             if (rc->successor().get() == nullptr) {
               d->build(n);
+              index()[n.get()] = d;
               DBG("build dag case-2 dag (%d)\n", (int)dag_build<param_t>::dags().size());
               return;
             }
@@ -667,7 +1167,7 @@ public:
       // case-0 (new): no related dag
       auto new_dag = std::make_shared<dag<param_t>>(dag<param_t>());
       new_dag->build(n);
-      dags().push_back(new_dag);
+      add_dag(new_dag);
       DBG("build dag case-3 dag (%d)\n", (int)dag_build<param_t>::dags().size());
       return;
     }
@@ -685,6 +1185,11 @@ public:
       else
         dag->set_tail(opt_cn);
 
+      auto& _index = index();
+      _index.erase(pre_cn.get());
+      _index.erase(cn.get());
+      _index[opt_cn.get()] = dag;
+
       // cut down pre_cn with cn
       pre_cn->reset_successor();
       pre_cn->reset_creator();
@@ -701,24 +1206,49 @@ public:
     }
 
     static dag_t fetch_dag(const param_t& t) {
-      for (auto d : dags()) {
-        // target tensor
-        auto tts = d->target_tensors();
-        for (auto tt : tts)
-          if (tt == t or t.computation_param_is_same(tt))
-            return d;
+      auto d = owner(t.creator());
+      if (d.get() == nullptr)
+        return nullptr;
 
-        // hidden tensor
-        if (d->is_associated(t)) {
+      // hidden tensor, split the nodes after its creator into a new dag
+      if (t.creator().get() != d->get_tail().get()) {
+        auto new_dag = d->rebuild(t);
+        add_dag(new_dag);
+      }
 
-          // rebuild
-          auto new_dag = d->rebuild(t);
-          dags().push_back(new_dag);
+      // target tensor
+      return d;
+    }
 
-          return d;
-        }
-      }
-      return nullptr;
+    /// The live dag holding node n, nullptr if none
+    static dag_t owner(const cn_t& n) {
+      if (n.get() == nullptr)
+        return nullptr;
+      auto& _index = index();
+      auto it = _index.find(n.get());
+      return it == _index.end() ? nullptr : it->second;
+    }
+
+    static size_t num_dags() { return dags().size(); }
+
+    static std::vector<dag_t> live_dags() {
+      return std::vector<dag_t>(dags().begin(), dags().end());
+    }
+
+    static std::vector<dag_t> dags_of(prop_kind_t pkind) {
+      std::vector<dag_t> found;
+      for (auto& d : dags())
+        if (d->prop_kind() == pkind)
+          found.push_back(d);
+      return found;
+    }
+
+    static std::vector<dag_t> weight_gradient_dags() {
+      std::vector<dag_t> found;
+      for (auto& d : dags())
+        if (d->get_head()->weight_gradient())
+          found.push_back(d);
+      return found;
     }
 
     static dag_t fetch_dag(prop_kind_t pkind) {
@@ -729,28 +1259,703 @@ public:
     }
 
     static void remove_dag(dag_t& d) {
+      auto& _index = index();
+      for (auto cn = d->get_head(); cn.get() != nullptr; cn = cn->successor()) {
+        auto it = _index.find(cn.get());
+        if (it != _index.end() && it->second.get() == d.get())
+          _index.erase(it);
+      }
+
+      auto& _positions = positions();
+      auto pos = _positions.find(d.get());
+      if (pos != _positions.end()) {
+        dags().erase(pos->second);
+        _positions.erase(pos);
+      }
+    }
+
+  private:
+    // Register d and index its nodes
+    static void add_dag(dag_t& d) {
       auto& _dags = dags();
-      for (auto iter = _dags.begin(); iter != _dags.end(); iter++) {
-        dag_t& _d = *iter;
-        if (_d.get() == d.get()) {
-          _dags.erase(iter);
-          break;
+      positions()[d.get()] = _dags.insert(_dags.end(), d);
+      auto& _index = index();
+      for (auto cn = d->get_head(); cn.get() != nullptr; cn = cn->successor())
+        _index[cn.get()] = d;
+    }
+
+    // Live dags of the current session, oldest first
+    static std::list<dag_t>& dags() {
+      return session<param_t>::current()->dags_;
+    }
+
+    static std::unordered_map<dag<param_t> *,
+        typename std::list<dag_t>::iterator>& positions() {
+      return session<param_t>::current()->positions_;
+    }
+
+    // Creator node => owning dag, for every node chained in a live dag
+    static std::unordered_map<_node<param_t> *, dag_t>& index() {
+      return session<param_t>::current()->index_;
+    }
+  };
+
+  /// Lazy evaluation state of one stream of ops: its live dags and the
+  /// current prop kind. Each thread enqueues into its own session unless
+  /// a scope binds another one, so threads issuing ops concurrently never
+  /// share dags. A tensor is always evaluated in the session that created
+  /// it, under that session's lock.
+  template<typename param_t>
+  class session : public std::enable_shared_from_this<session<param_t>> {
+  public:
+    using prop_kind_t = typename node<param_t>::prop_kind_t;
+    typedef typename std::shared_ptr<dag<param_t>> dag_t;
+
+    static std::shared_ptr<session> create() {
+      return std::shared_ptr<session>(new session());
+    }
+
+    /// Runs the dags left pending
+    ~session() {
+      scope bind(this);
+      std::lock_guard<std::recursive_mutex> lock(mutex_);
+      try {
+        if (async_executor<param_t>::is_enabled())
+          async_executor<param_t>::flush();
+        while (!dags_.empty()) {
+          auto d = dags_.front();
+          dag_scheduler<param_t>::run(d);
         }
+      } catch (...) {
       }
     }
 
+    /// Makes s the session of the calling thread until destroyed
+    class scope {
+    public:
+      explicit scope(session *s) : prev_(bound()) { bound() = s; }
+      explicit scope(const std::shared_ptr<session>& s) : scope(s.get()) {}
+      ~scope() { bound() = prev_; }
+
+    private:
+      session *prev_;
+    };
+
+    /// Session bound to the calling thread, or the thread's own one
+    static session *current() {
+      auto s = bound();
+      if (s != nullptr)
+        return s;
+      static thread_local std::shared_ptr<session> own_ = create();
+      return own_.get();
+    }
+
+    std::recursive_mutex& mutex() { return mutex_; }
+
   private:
-    static std::vector<dag_t>& dags() {
-      static std::vector<dag_t> dags_;
-      return dags_;
+    friend class dag_build<param_t>;
+    friend class executor<param_t>;
+
+    session() = default;
+
+    static session *&bound() {
+      static thread_local session *bound_ = nullptr;
+      return bound_;
     }
+
+    std::recursive_mutex mutex_;
+    std::list<dag_t> dags_;
+    std::unordered_map<dag<param_t> *,
+        typename std::list<dag_t>::iterator> positions_;
+    std::unordered_map<_node<param_t> *, dag_t> index_;
+    prop_kind_t pkind_ = prop_kind_t::CN_PROP_NA;
+    bool pkind_init_ = false;
   };
 
+  /// Runs a dag after the pending dags it reads from. Dependencies are
+  /// grouped into levels, dags of one level do not read each other and
+  /// are executed concurrently, each on its own share of the OpenMP
+  /// threads.
+  template<typename param_t>
+  class dag_scheduler {
+  public:
+    typedef typename std::shared_ptr<dag<param_t>> dag_t;
+
+    /// Run d, and the side dags in the same levels where they fit
+    static void run(dag_t& d, std::vector<dag_t> side = {}) {
+      std::vector<std::vector<dag_t>> levels;
+      std::unordered_map<dag<param_t> *, int> visited;
+
+      // Side dags may split d at the tensors they read, the part ending
+      // with the requested tail is the one to run
+      auto tail = d->get_tail();
+      for (auto& s : side)
+        if (dag_build<param_t>::owner(s->get_head()).get() == s.get())
+          plan(s, levels, visited);
+      auto root = dag_build<param_t>::owner(tail);
+      if (root.get() != nullptr)
+        plan(root, levels, visited);
+
+      for (auto& level : levels) {
+        for (auto& l : level) {
+          dag_optimizer<param_t>::optimize(l);
+          dag_memory_planner<param_t>::plan(l);
+        }
+        execute(level);
+        for (auto& l : level)
+          dag_build<param_t>::remove_dag(l);
+      }
+    }
+
+    typedef std::vector<std::vector<dag_t>> levels_t;
+
+    /// Plan roots and the dags they read, optimize them all and take them
+    /// out of dag_build, so that they can be executed on another thread
+    static levels_t prepare(std::vector<dag_t>& roots) {
+      levels_t levels;
+      std::unordered_map<dag<param_t> *, int> visited;
+      for (auto& d : roots)
+        plan(d, levels, visited);
+
+      for (auto& level : levels) {
+        for (auto& l : level) {
+          dag_optimizer<param_t>::optimize(l);
+          dag_memory_planner<param_t>::plan(l);
+          dag_build<param_t>::remove_dag(l);
+        }
+      }
+      return levels;
+    }
+
+    static void execute_levels(levels_t& levels) {
+      for (auto& level : levels)
+        execute(level);
+    }
+
+    // DISABLE_PARALLEL_BRANCH=1 executes dependent dags one by one
+    static bool is_enabled() {
+      return enabled();
+    }
+
+    static void set_enabled(bool on) {
+      enabled() = on;
+    }
+
+  private:
+    static bool& enabled() {
+      static bool enabled_ = [] {
+        const char *env = getenv("DISABLE_PARALLEL_BRANCH");
+        return !(env != nullptr && *env != '0');
+      }();
+      return enabled_;
+    }
+
+    // Level of d is one above the highest level among the dags it reads
+    static int plan(dag_t& d, std::vector<std::vector<dag_t>>& levels,
+        std::unordered_map<dag<param_t> *, int>& visited) {
+      auto it = visited.find(d.get());
+      if (it != visited.end())
+        return it->second;
+      visited[d.get()] = 0;
+
+      int level = 0;
+      for (auto cn = d->get_head(); cn.get() != nullptr; cn = cn->successor()) {
+        for (auto& dep : cn->deps()) {
+          // Computed or in flight tensors have no owner
+          auto dd = dag_build<param_t>::owner(dep.creator());
+          if (dd.get() == nullptr || dd.get() == d.get())
+            continue;
+          // Split off the nodes after a hidden tensor unless the whole
+          // dag is planned already
+          if (visited.find(dd.get()) == visited.end())
+            dd = dag_build<param_t>::fetch_dag(dep);
+          level = std::max(level, plan(dd, levels, visited) + 1);
+        }
+      }
+
+      visited[d.get()] = level;
+      if ((int)levels.size() <= level)
+        levels.resize(level + 1);
+      levels[level].push_back(d);
+      return level;
+    }
+
+    // Dags of a level grouped into branches. Dags holding the state of
+    // the same cached computation, e.g. two convolutions of one shape, go
+    // to the same branch and run one after the other.
+    static std::vector<std::vector<dag_t>> branches_of(
+        std::vector<dag_t>& level) {
+      std::vector<int> parent(level.size());
+      for (int i = 0; i < (int)level.size(); i++)
+        parent[i] = i;
+      auto root = [&parent](int i) {
+        while (parent[i] != i)
+          i = parent[i] = parent[parent[i]];
+        return i;
+      };
+
+      std::unordered_map<const void *, int> holder;
+      auto hold = [&](int i, const typename dag<param_t>::cn_t& cn) {
+        auto state = cn->shared_state();
+        if (state == nullptr)
+          return;
+        auto it = holder.find(state);
+        if (it == holder.end())
+          holder[state] = i;
+        else
+          parent[root(i)] = root(it->second);
+      };
+
+      for (int i = 0; i < (int)level.size(); i++) {
+        for (auto cn = level[i]->get_head(); cn.get() != nullptr;
+            cn = cn->successor()) {
+          hold(i, cn);
+          // Scattered creators fire along with their readers
+          for (auto& dep : cn->deps())
+            if (dep.creator().get() != nullptr && dep.creator()->scattered())
+              hold(i, dep.creator());
+        }
+      }
+
+      std::vector<std::vector<dag_t>> branches;
+      std::unordered_map<int, size_t> index;
+      for (int i = 0; i < (int)level.size(); i++) {
+        auto r = root(i);
+        auto it = index.find(r);
+        if (it == index.end()) {
+          index[r] = branches.size();
+          branches.push_back({level[i]});
+        } else {
+          branches[it->second].push_back(level[i]);
+        }
+      }
+      return branches;
+    }
+
+    static void execute(std::vector<dag_t>& level) {
+#ifdef _OPENMP
+      int nthr = omp_get_max_threads();
+      if (!enabled() || level.size() < 2 || nthr < 2 || omp_in_parallel()) {
+        for (auto& l : level)
+          l->execute();
+        return;
+      }
+
+      auto branches = branches_of(level);
+      int nbranches = std::min((int)branches.size(), nthr);
+      if (nbranches < 2) {
+        for (auto& l : level)
+          l->execute();
+        return;
+      }
+
+      int max_levels = omp_get_max_active_levels();
+      omp_set_max_active_levels(std::max(max_levels, 2));
+
+      std::exception_ptr failure = nullptr;
+      # pragma omp parallel for num_threads(nbranches) schedule(static, 1)
+      for (int i = 0; i < (int)branches.size(); i++) {
+        int ithr = omp_get_thread_num();
+        omp_set_num_threads(nthr / nbranches + (ithr < nthr % nbranches));
+        try {
+          for (auto& l : branches[i])
+            l->execute();
+        } catch (...) {
+          # pragma omp critical
+          failure = std::current_exception();
+        }
+      }
+
+      omp_set_max_active_levels(max_levels);
+      if (failure != nullptr)
+        std::rethrow_exception(failure);
+#else
+      for (auto& l : level)
+        l->execute();
+#endif
+    }
+  };
+
+  /// Executes dags on a background thread. Every batch() enqueued nodes,
+  /// or when a pending tensor is read, all live dags are prepared on the
+  /// calling thread and handed over as one job. Jobs run in submission
+  /// order, so a job never reads a tensor of a later one. Reading a tensor
+  /// in flight blocks until its job is done.
+  template<typename param_t>
+  class async_executor {
+  public:
+    typedef typename std::shared_ptr<dag<param_t>> dag_t;
+    using levels_t = typename dag_scheduler<param_t>::levels_t;
+
+    // ASYNC_EXECUTOR=1 turns the background thread on
+    static bool is_enabled() {
+      return state().enabled;
+    }
+
+    static void set_enabled(bool on) {
+      if (!on)
+        synchronize();
+      state().enabled = on;
+    }
+
+    // ASYNC_BATCH nodes per job, 16 by default
+    static size_t& batch() {
+      static size_t batch_ = [] {
+        const char *env = getenv("ASYNC_BATCH");
+        return env != nullptr && atoi(env) > 0 ? (size_t)atoi(env) : 16;
+      }();
+      return batch_;
+    }
+
+    static void enqueued() {
+      auto& st = state();
+      if (st.enabled && ++st.pending >= batch())
+        flush();
+    }
+
+    /// Hand all live dags over to the background thread
+    static void flush() {
+      auto& st = state();
+      st.pending = 0;
+      auto roots = dag_build<param_t>::live_dags();
+      if (roots.empty())
+        return;
+
+      std::shared_ptr<job> j = std::make_shared<job>();
+      j->levels = dag_scheduler<param_t>::prepare(roots);
+
+      std::lock_guard<std::mutex> lock(st.mutex);
+      j->seq = ++st.submitted;
+      for (auto& level : j->levels)
+        for (auto& d : level)
+          for (auto cn = d->get_head(); cn.get() != nullptr;
+              cn = cn->successor()) {
+            st.in_flight[cn.get()] = j->seq;
+            for (auto& dep : cn->deps()) {
+              j->reads.push_back(dep.get_materialized().get());
+              st.reading[j->reads.back()] = j->seq;
+            }
+          }
+      st.jobs.push_back(j);
+      st.outstanding ++;
+      if (!st.worker.joinable())
+        st.worker = std::thread(work);
+      st.submit_cond.notify_one();
+    }
+
+    /// Materialize t on the background thread
+    static void evaluate(const param_t& t) {
+      if (wait(t))
+        return;
+      flush();
+      wait(t);
+    }
+
+    /// Block until the job computing t is done, and for a write also the
+    /// jobs reading t. Returns false when t is not computed in flight.
+    /// Nodes firing on the worker never wait, their job is the one running.
+    static bool wait(const param_t& t, bool write = false) {
+      auto& st = state();
+      if (st.outstanding == 0 || firing())
+        return false;
+
+      std::unique_lock<std::mutex> lock(st.mutex);
+      size_t seq = 0;
+      auto it = st.in_flight.find(t.creator().get());
+      if (it != st.in_flight.end())
+        seq = it->second;
+      auto computed = seq != 0;
+      if (write) {
+        auto r = st.reading.find(t.get_materialized().get());
+        if (r != st.reading.end())
+          seq = std::max(seq, r->second);
+      }
+      if (seq == 0)
+        return false;
+      st.done_cond.wait(lock, [&] { return st.done >= seq; });
+      rethrow(st);
+      return computed;
+    }
+
+    /// Block until every submitted job is done
+    static void synchronize() {
+      auto& st = state();
+      if (st.enabled)
+        flush();
+      std::unique_lock<std::mutex> lock(st.mutex);
+      st.done_cond.wait(lock, [&] { return st.done == st.submitted; });
+      rethrow(st);
+    }
+
+  private:
+    struct job {
+      size_t seq;
+      levels_t levels;
+      std::vector<flag_t *> reads;
+    };
+
+    struct state_t {
+      state_t() : enabled([] {
+          const char *env = getenv("ASYNC_EXECUTOR");
+          return env != nullptr && *env != '0';
+        }()) {}
+
+      ~state_t() {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          stop = true;
+          submit_cond.notify_one();
+        }
+        if (worker.joinable())
+          worker.join();
+      }
+
+      bool enabled;
+      std::atomic<size_t> pending {0};
+      std::mutex mutex;
+      std::condition_variable submit_cond, done_cond;
+      std::list<std::shared_ptr<job>> jobs;
+      std::unordered_map<_node<param_t> *, size_t> in_flight;
+      // Deps of in-flight nodes, with the last job reading them
+      std::unordered_map<flag_t *, size_t> reading;
+      size_t submitted = 0, done = 0;
+      std::atomic<size_t> outstanding {0};
+      std::exception_ptr failure = nullptr;
+      bool stop = false;
+      std::thread worker;
+    };
+
+    static state_t& state() {
+      static state_t state_;
+      return state_;
+    }
+
+    // Failure of a background job surfaces at the next wait
+    static void rethrow(state_t& st) {
+      if (st.failure != nullptr) {
+        auto failure = st.failure;
+        st.failure = nullptr;
+        std::rethrow_exception(failure);
+      }
+    }
+
+    static void work() {
+      auto& st = state();
+      std::unique_lock<std::mutex> lock(st.mutex);
+      while (true) {
+        st.submit_cond.wait(lock, [&] { return st.stop || !st.jobs.empty(); });
+        if (st.jobs.empty())
+          return;
+        auto j = st.jobs.front();
+        st.jobs.pop_front();
+        lock.unlock();
+
+        std::exception_ptr failure = nullptr;
+        try {
+          dag_scheduler<param_t>::execute_levels(j->levels);
+        } catch (...) {
+          failure = std::current_exception();
+        }
+
+        lock.lock();
+        for (auto& level : j->levels)
+          for (auto& d : level)
+            for (auto cn = d->get_head(); cn.get() != nullptr;
+                cn = cn->successor())
+              st.in_flight.erase(cn.get());
+        // Nodes drop their deps once fired, the job kept the flags
+        for (auto read : j->reads) {
+          auto r = st.reading.find(read);
+          if (r != st.reading.end() && r->second == j->seq)
+            st.reading.erase(r);
+        }
+        if (failure != nullptr)
+          st.failure = failure;
+        st.done = j->seq;
+        st.outstanding --;
+        st.done_cond.notify_all();
+      }
+    }
+  };
+
+  /// Shares buffers among the intermediate tensors of a dag. A tensor is
+  /// an intermediate when every handle to it is held by the dag nodes, so
+  /// nothing outside can observe its buffer. Intermediates whose lifetimes
+  /// do not overlap are packed into the same slot, backed by the buffer
+  /// of the first tensor placed there; the other buffers are released
+  /// before the dag runs.
+  template<typename param_t>
+  class dag_memory_planner {
+  public:
+    typedef typename std::shared_ptr<dag<param_t>> dag_t;
+
+    struct memory_report {
+      size_t tensors;       // intermediates planned
+      size_t slots;         // buffers kept for them
+      size_t tensor_bytes;  // bytes they used to hold
+      size_t slot_bytes;    // bytes they hold after planning
+    };
+
+    static void plan(dag_t& d) {
+      if (!is_enabled())
+        return;
+
+      std::vector<lifetime> lives;
+      std::unordered_map<flag_t *, size_t> ids;
+      int step = 0;
+      for (auto cn = d->get_head(); cn.get() != nullptr;
+          cn = cn->successor(), step++) {
+        for (auto& dep : cn->deps()) {
+          auto it = ids.find(dep.get_materialized().get());
+          if (it == ids.end())
+            continue;
+          lives[it->second].last = step;
+          lives[it->second].handles.push_back(&dep);
+        }
+
+        auto& tars = cn->tars();
+        for (size_t i = 0; i < tars.size(); i++) {
+          auto key = tars[i].get_materialized().get();
+          if (ids.find(key) != ids.end())
+            continue;
+          ids[key] = lives.size();
+          lives.push_back({step, step, tars[i].computation_param_size(),
+              i == 0 && cn->inplace() ? owner_of(cn->deps(), ids) : -1,
+              {&tars[i]}});
+        }
+      }
+
+      // Target tensors of d are read by the caller
+      for (auto& tar : d->target_tensors())
+        ids.erase(tar.get_materialized().get());
+
+      std::vector<int> slot_of(lives.size(), -1);
+      std::vector<slot> slots;
+      size_t tensors = 0, tensor_bytes = 0;
+      for (size_t i = 0; i < lives.size(); i++) {
+        auto& life = lives[i];
+        if (!is_intermediate(life, ids))
+          continue;
+
+        // Overwrite the source in place when this node is its last reader,
+        // otherwise take the smallest idle slot big enough
+        int s = -1;
+        if (life.source >= 0 && slot_of[life.source] >= 0 &&
+            lives[life.source].last == life.first &&
+            slots[slot_of[life.source]].size >= life.size) {
+          s = slot_of[life.source];
+        } else {
+          for (int j = 0; j < (int)slots.size(); j++)
+            if (slots[j].busy < life.first && slots[j].size >= life.size &&
+                (s < 0 || slots[j].size < slots[s].size))
+              s = j;
+        }
+
+        if (s < 0) {
+          s = slots.size();
+          slots.push_back({life.size, life.last,
+              life.handles[0]->computation_param_buffer()});
+        } else {
+          slots[s].busy = std::max(slots[s].busy, life.last);
+          for (auto handle : life.handles)
+            handle->computation_param_rebind(slots[s].buffer);
+        }
+        slot_of[i] = s;
+        tensors ++;
+        tensor_bytes += life.size;
+      }
+
+      size_t slot_bytes = 0;
+      for (auto& sl : slots)
+        slot_bytes += sl.size;
+
+      static std::mutex mutex;
+      std::lock_guard<std::mutex> lock(mutex);
+      report().tensors += tensors;
+      report().tensor_bytes += tensor_bytes;
+      report().slots += slots.size();
+      report().slot_bytes += slot_bytes;
+    }
+
+    // DISABLE_MEMORY_PLAN=1 keeps one buffer per tensor
+    static bool is_enabled() {
+      return enabled();
+    }
+
+    static void set_enabled(bool on) {
+      enabled() = on;
+    }
+
+    static memory_report& report() {
+      static memory_report report_ = {0, 0, 0, 0};
+      return report_;
+    }
+
+    static void reset_report() {
+      report() = memory_report{0, 0, 0, 0};
+    }
+
+  private:
+    struct lifetime {
+      int first;    // step writing the tensor
+      int last;     // last step reading it
+      size_t size;
+      int source;   // lifetime the tensor may overwrite in place
+      std::vector<param_t *> handles;
+    };
+
+    struct slot {
+      size_t size;
+      int busy;     // last step using the slot
+      std::shared_ptr<char> buffer;
+    };
+
+    static bool& enabled() {
+      static bool enabled_ = [] {
+        const char *env = getenv("DISABLE_MEMORY_PLAN");
+        return !(env != nullptr && *env != '0');
+      }();
+      return enabled_;
+    }
+
+    static int owner_of(std::vector<param_t>& deps,
+        std::unordered_map<flag_t *, size_t>& ids) {
+      if (deps.empty())
+        return -1;
+      auto it = ids.find(deps[0].get_materialized().get());
+      return it == ids.end() ? -1 : (int)it->second;
+    }
+
+    // Held by the dag only: one reference per handle, plus the copy
+    // taken here
+    static bool is_intermediate(lifetime& life,
+        std::unordered_map<flag_t *, size_t>& ids) {
+      if (life.size == 0)
+        return false;
+      auto materialized = life.handles[0]->get_materialized();
+      if (ids.find(materialized.get()) == ids.end())
+        return false;
+      return materialized.use_count() == (long)life.handles.size() + 1 &&
+          life.handles[0]->computation_param_buffer().get() != nullptr;
+    }
+  };
+
+  /// Rewrites conv->relu, conv->sum and conv->bn pairs of a dag into a
+  /// single convolution with post ops or folded weights. A pair is fused
+  /// only when the convolution output has no reader besides the next node,
+  /// since the fused node never writes it.
   template<typename param_t>
   class dag_optimizer {
   public:
     typedef typename std::shared_ptr<dag<param_t>> dag_t;
     typedef typename std::shared_ptr<_node<param_t>> cn_t;
+    using fusion_type_t = typename node<param_t>::fusion_type_t;
+
+    // Counters per pattern, keyed by the fusion type of the follower
+    struct fusion_report {
+      size_t candidates;  // conv directly feeding the pattern
+      size_t fused;
+    };
 
     static void optimize(dag_t& dag) {
       cn_t pre = dag->get_head();
@@ -758,16 +1963,347 @@ public:
       cn_t pre_opt = pre;
 
       for (; cur.get(); pre = cur, cur = cur->successor()) {
-        auto opt_cn = pre->fuse(cur);
-        if (opt_cn.get()) {
-          dag_build<param_t>::trim_dag(dag, pre_opt, opt_cn, pre, cur);
-          // reset pre and cur position
-          pre = pre_opt;
-          cur = opt_cn;
+        auto ftype = cur->fusion_attr().ftype;
+        if (pre->fusion_attr().ftype == fusion_type_t::CN_FUSION_CONV &&
+            ftype < fusion_type_t::CN_FUSION_NA &&
+            ftype != fusion_type_t::CN_FUSION_CONV && sole_reader(pre, cur)) {
+          count(ftype, false);
+          auto opt_cn = is_enabled(ftype) ? pre->fuse(cur) : nullptr;
+          if (opt_cn.get()) {
+            count(ftype, true);
+            opt_cn->set_session(pre->get_session());
+            opt_cn->set_fused();
+            dag_build<param_t>::trim_dag(dag, pre_opt, opt_cn, pre, cur);
+            // reset pre and cur position
+            pre = pre_opt;
+            cur = opt_cn;
+          }
         }
         pre_opt = pre;
       }
     }
+
+    static bool is_enabled(fusion_type_t ftype) {
+      return switches()[ftype];
+    }
+
+    static void set_enabled(fusion_type_t ftype, bool enabled) {
+      switches()[ftype] = enabled;
+    }
+
+    static fusion_report& report(fusion_type_t ftype) {
+      static fusion_report reports_[fusion_type_t::CN_FUSION_NA] = {};
+      return reports_[ftype];
+    }
+
+    static void reset_report() {
+      for (int i = 0; i < fusion_type_t::CN_FUSION_NA; i++)
+        report(static_cast<fusion_type_t>(i)) = fusion_report{0, 0};
+    }
+
+    /// Pattern name of a fusion type, as used by DISABLE_FUSION_OPT
+    static const char *pattern_name(fusion_type_t ftype) {
+      switch (ftype) {
+      case fusion_type_t::CN_FUSION_CONV: return "conv";
+      case fusion_type_t::CN_FUSION_RELU: return "relu";
+      case fusion_type_t::CN_FUSION_SUM: return "sum";
+      case fusion_type_t::CN_FUSION_BN: return "bn";
+      default: return "na";
+      }
+    }
+
+  private:
+    static void count(fusion_type_t ftype, bool fused) {
+      static std::mutex mutex;
+      std::lock_guard<std::mutex> lock(mutex);
+      if (fused)
+        report(ftype).fused ++;
+      else
+        report(ftype).candidates ++;
+    }
+
+    // Whether cur consumes the output of pre and nobody else holds it:
+    // one reference for pre's targets, one per dependency of cur, plus
+    // the copy taken here.
+    static bool sole_reader(cn_t& pre, cn_t& cur) {
+      if (pre->tars().empty())
+        return false;
+      long refs = 1;
+      for (auto& dep : cur->deps())
+        if (dep.creator().get() == pre.get())
+          refs ++;
+      return refs > 1 &&
+          pre->tars()[0].get_materialized().use_count() == refs + 1;
+    }
+
+    // DISABLE_FUSION_OPT=all, or a comma separated list of relu, sum, bn
+    static bool *switches() {
+      static bool *switches_ = [] {
+        static bool parsed[fusion_type_t::CN_FUSION_NA];
+        const char *env = getenv("DISABLE_FUSION_OPT");
+        std::string disabled = env ? env : "";
+        for (int i = 0; i < fusion_type_t::CN_FUSION_NA; i++) {
+          std::string name = pattern_name(static_cast<fusion_type_t>(i));
+          parsed[i] = !(disabled == "1" || disabled == "all" ||
+              ("," + disabled + ",").find("," + name + ",")
+              != std::string::npos);
+        }
+        return parsed;
+      }();
+      return switches_;
+    }
+  };
+
+  /// A recorded sequence of computations. Nodes fired between
+  /// begin_capture() and end_capture() are kept with private copies of
+  /// their parameters; replay() only points the inputs and outputs at new
+  /// buffers and fires the computations again, without building nodes or
+  /// dags. Parameters that are neither inputs nor outputs, like weights,
+  /// stay bound to the buffers seen during capture.
+  template<typename param_t>
+  class graph {
+  public:
+    typedef typename std::shared_ptr<_node<param_t>> cn_t;
+
+    /// Start recording the nodes of the current session fired from now on
+    static void begin_capture() {
+      auto& state = capture_state();
+      std::lock_guard<std::mutex> lock(state.mutex);
+      state.steps.clear();
+      state.owner = session<param_t>::current();
+      state.active = true;
+      state.complete = true;
+    }
+
+    /// Stop recording after materializing outputs. Returns nullptr when
+    /// some computation ran outside the web during capture, or when the
+    /// recorded steps would overwrite an input.
+    static std::shared_ptr<graph> end_capture(
+        const std::vector<param_t>& inputs,
+        const std::vector<param_t>& outputs) {
+      for (auto& out : outputs)
+        parameter<param_t>::computation_param_materialize(out);
+
+      auto& state = capture_state();
+      std::vector<step> steps;
+      {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.active = false;
+        steps.swap(state.steps);
+        if (!state.complete)
+          return nullptr;
+      }
+
+      auto g = std::make_shared<graph>();
+      if (!g->build(steps, inputs, outputs))
+        return nullptr;
+      return g;
+    }
+
+    /// end_capture(), then keep the graph for lookup() under name
+    static std::shared_ptr<graph> end_capture(const std::string& name,
+        const std::vector<param_t>& inputs,
+        const std::vector<param_t>& outputs) {
+      auto g = end_capture(inputs, outputs);
+      if (g.get() != nullptr) {
+        std::lock_guard<std::mutex> lock(capture_state().mutex);
+        registry()[name].push_back(g);
+      }
+      return g;
+    }
+
+    /// The graph captured under name for inputs of the same layouts
+    static std::shared_ptr<graph> lookup(const std::string& name,
+        const std::vector<param_t>& inputs) {
+      std::lock_guard<std::mutex> lock(capture_state().mutex);
+      auto it = registry().find(name);
+      if (it == registry().end())
+        return nullptr;
+      for (auto& g : it->second)
+        if (g->match(inputs))
+          return g;
+      return nullptr;
+    }
+
+    static void clear_registry() {
+      std::lock_guard<std::mutex> lock(capture_state().mutex);
+      registry().clear();
+    }
+
+    static bool capturing() {
+      return capture_state().active;
+    }
+
+    static void record(cn_t cn) {
+      auto& state = capture_state();
+      if (!state.active || cn->get_session().lock().get() != state.owner)
+        return;
+      std::lock_guard<std::mutex> lock(state.mutex);
+      state.steps.push_back({cn->comp(), cn->deps(), cn->tars()});
+    }
+
+    // A computation bypassed the web, the capture can't be replayed
+    static void interrupt() {
+      auto& state = capture_state();
+      if (state.active && session<param_t>::current() == state.owner)
+        state.complete = false;
+    }
+
+    // A primitive ran on this thread, outside of a node unless firing
+    static void executed() {
+      if (!firing())
+        interrupt();
+    }
+
+    bool match(const std::vector<param_t>& inputs) const {
+      if (inputs.size() != inputs_.size())
+        return false;
+      for (size_t i = 0; i < inputs.size(); i++)
+        if (!inputs_[i].computation_param_compatible(inputs[i]))
+          return false;
+      return true;
+    }
+
+    /// Run the graph on new inputs, writing into outputs laid out like the
+    /// captured ones. Returns false without computing if they don't match.
+    bool replay(const std::vector<param_t>& inputs,
+        const std::vector<param_t>& outputs) {
+      if (!match(inputs) || outputs.size() != outputs_.size())
+        return false;
+      for (size_t i = 0; i < outputs.size(); i++)
+        if (!outputs_[i].computation_param_compatible(outputs[i]))
+          return false;
+
+      for (auto& b : bindings_) {
+        auto& src = const_cast<param_t&>(b.index < inputs.size() ?
+            inputs[b.index] : outputs[b.index - inputs.size()]);
+        auto& s = steps_[b.step];
+        auto& p = b.tar ? s.tars[b.pos] : s.deps[b.pos];
+        p.computation_param_attach(b.extra ? *src.get_extra() : src);
+      }
+
+      for (auto& s : steps_)
+        s.comp->fire_computation_node(s.deps, s.tars);
+      return true;
+    }
+
+    size_t num_steps() const { return steps_.size(); }
+
+  private:
+    struct step {
+      std::shared_ptr<node<param_t>> comp;
+      std::vector<param_t> deps;
+      std::vector<param_t> tars;
+    };
+
+    // A step parameter that follows an input or output on replay
+    struct binding {
+      size_t step;
+      bool tar;
+      size_t pos;
+      size_t index;   // into inputs, then outputs
+      bool extra;
+    };
+
+    struct state_t {
+      std::mutex mutex;
+      std::vector<step> steps;
+      std::atomic<bool> active {false};
+      std::atomic<bool> complete {true};
+      std::atomic<session<param_t> *> owner {nullptr};
+    };
+
+    static state_t& capture_state() {
+      static state_t state_;
+      return state_;
+    }
+
+    static std::unordered_map<std::string,
+        std::vector<std::shared_ptr<graph>>>& registry() {
+      static std::unordered_map<std::string,
+          std::vector<std::shared_ptr<graph>>> registry_;
+      return registry_;
+    }
+
+    static flag_t *key(const param_t& p) {
+      return p.get_materialized().get();
+    }
+
+    bool build(std::vector<step>& steps, const std::vector<param_t>& inputs,
+        const std::vector<param_t>& outputs) {
+      std::unordered_map<flag_t *, std::pair<size_t, bool>> bound;
+      auto bind = [&](const param_t& p, size_t index) {
+        bound[key(p)] = {index, false};
+        if (p.has_extra())
+          bound[key(*const_cast<param_t&>(p).get_extra())] = {index, true};
+      };
+      for (size_t i = 0; i < inputs.size(); i++)
+        bind(inputs[i], i);
+      std::unordered_set<flag_t *> input_keys;
+      for (auto& b : bound)
+        input_keys.insert(b.first);
+      for (size_t i = 0; i < outputs.size(); i++)
+        bind(outputs[i], inputs.size() + i);
+
+      // Keep the steps the outputs are computed from
+      std::unordered_set<flag_t *> needed;
+      for (auto& out : outputs)
+        needed.insert(key(out));
+      std::vector<bool> keep(steps.size(), false);
+      for (size_t i = steps.size(); i-- > 0;) {
+        for (auto& tar : steps[i].tars)
+          keep[i] = keep[i] || needed.count(key(tar)) != 0;
+        if (!keep[i])
+          continue;
+        for (auto& tar : steps[i].tars)
+          if (input_keys.count(key(tar)) != 0)
+            return false;
+        for (auto& dep : steps[i].deps)
+          needed.insert(key(dep));
+      }
+
+      // Private copies, so that rebinding leaves the captured ones alone
+      std::unordered_map<flag_t *, param_t> clones;
+      auto clone_of = [&](const param_t& p) -> param_t& {
+        auto it = clones.find(key(p));
+        if (it == clones.end())
+          it = clones.emplace(key(p), p.computation_param_clone()).first;
+        return it->second;
+      };
+      for (size_t i = 0; i < steps.size(); i++) {
+        if (!keep[i])
+          continue;
+        step s{steps[i].comp, {}, {}};
+        for (auto& dep : steps[i].deps) {
+          auto b = bound.find(key(dep));
+          if (b != bound.end())
+            bindings_.push_back({steps_.size(), false, s.deps.size(),
+                b->second.first, b->second.second});
+          s.deps.push_back(clone_of(dep));
+        }
+        for (auto& tar : steps[i].tars) {
+          auto b = bound.find(key(tar));
+          if (b != bound.end())
+            bindings_.push_back({steps_.size(), true, s.tars.size(),
+                b->second.first, b->second.second});
+          s.tars.push_back(clone_of(tar));
+        }
+        steps_.push_back(std::move(s));
+      }
+      if (steps_.empty())
+        return false;
+
+      for (auto& in : inputs)
+        inputs_.push_back(in.computation_param_clone());
+      for (auto& out : outputs)
+        outputs_.push_back(out.computation_param_clone());
+      return true;
+    }
+
+    std::vector<step> steps_;
+    std::vector<binding> bindings_;
+    std::vector<param_t> inputs_;
+    std::vector<param_t> outputs_;
   };
 };
 
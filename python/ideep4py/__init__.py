@@ -21,6 +21,19 @@ from ideep4py._ideep4py import relu  # NOQA
 
 from ideep4py._ideep4py import basic_acc_sum  # NOQA
 from ideep4py._ideep4py import basic_copyto  # NOQA
+from ideep4py._ideep4py import basic_cache_stats as cache_stats  # NOQA
+from ideep4py._ideep4py import basic_reset_cache_stats as reset_cache_stats  # NOQA
+from ideep4py._ideep4py import basic_set_cache_capacity as set_cache_capacity  # NOQA
+from ideep4py._ideep4py import basic_pool_stats as pool_stats  # NOQA
+from ideep4py._ideep4py import basic_trim_pool as trim_pool  # NOQA
+from ideep4py._ideep4py import basic_set_pool_limit as set_pool_limit  # NOQA
+from ideep4py._ideep4py import basic_set_huge_page as set_huge_page  # NOQA
+from ideep4py._ideep4py import basic_fusion_report as fusion_report  # NOQA
+from ideep4py._ideep4py import basic_set_fusion as set_fusion  # NOQA
+from ideep4py._ideep4py import basic_set_async as set_async  # NOQA
+from ideep4py._ideep4py import basic_set_autotune as set_autotune  # NOQA
+from ideep4py._ideep4py import basic_set_trace as set_trace  # NOQA
+from ideep4py._ideep4py import basic_dump_trace as dump_trace  # NOQA
 
 from ideep4py._ideep4py import distribute    # NOQA
 
@@ -222,6 +235,42 @@ class convolution2D(object):
         """
         return _convolution2D.Forward(src, weights, bias, cp)
 
+    @classmethod
+    def ForwardFused(cls, src, weights, bias, cp, residual=None,
+                     sum_scale=1.0, relu=True, negative_slope=0.0,
+                     upper_bound=0.0):
+        """convolution2D forward propagation with a fused epilogue
+
+        Computes activation(conv(src, weights) + bias
+        + sum_scale * residual) in one pass over the output.
+
+        Args:
+            src (ideep4py.mdarray):
+                ``src`` feature maps of convolution2D forward propagation.
+            weights (ideep4py.mdarray):
+                ``weights`` filters of convolution2D forward propagation.
+            bias (ideep4py.mdarray):
+                ``bias`` bias of convolution2D forward propagation, or None.
+            cp (ideep4py.convolution2DParam):
+                ``cp`` convolution2D parameters (stride, padding,
+                output dimension, dilatation).
+            residual (ideep4py.mdarray):
+                ``residual`` added to the output, or None. It is not
+                modified.
+            sum_scale (float): scale of ``residual``.
+            relu (bool): whether to apply relu.
+            negative_slope (float): slope of relu for negative values.
+            upper_bound (float): clip the output at this bound when
+                positive, as a bounded relu.
+
+        Returns:
+            ideep4py.mdarray: dst of convolution2D forward propagation.
+
+        """
+        return _convolution2D.ForwardFused(src, weights, bias, cp, residual,
+                                           sum_scale, relu, negative_slope,
+                                           upper_bound)
+
     @classmethod
     def BackwardWeights(cls, src, grady, cp):
         """backward propagation on convolution2D weights
@@ -24,6 +24,7 @@
 
 #pragma once
 #include <cstring>
+#include <fstream>
 #include <Python.h>
 #include "mdarray.h"
 #include "ideep.hpp"
@@ -81,4 +82,200 @@ public:
     sum::compute(scales, inputs, output);
     return mdarray(output);
   }
+
+  // Primitive cache counters of every op, keyed by op name
+  static PyObject *cache_stats() {
+    PyObject *all = PyDict_New();
+    for (auto &entry : cache_table()) {
+      auto stats = entry.stats();
+      PyObject *item = Py_BuildValue("{s:K,s:K,s:K,s:K,s:n}",
+          "hits", static_cast<unsigned long long>(stats.hits),
+          "misses", static_cast<unsigned long long>(stats.misses),
+          "evictions", static_cast<unsigned long long>(stats.evictions),
+          "creation_ns", static_cast<unsigned long long>(stats.creation_ns),
+          "capacity", static_cast<Py_ssize_t>(stats.capacity));
+      PyDict_SetItemString(all, entry.name, item);
+      Py_DECREF(item);
+    }
+    return all;
+  }
+
+  static void reset_cache_stats() {
+    for (auto &entry : cache_table())
+      entry.reset_stats();
+  }
+
+  // Set primitive cache capacity of op name, or of all ops with "all"
+  static void set_cache_capacity(const std::string &op, int capacity) {
+    if (capacity <= 0) {
+      throw error(mkldnn_invalid_arguments,
+            std::string("cache capacity must be positive"));
+    }
+
+    bool found = false;
+    for (auto &entry : cache_table()) {
+      if (op == "all" || op == entry.name) {
+        entry.set_capacity(static_cast<size_t>(capacity));
+        found = true;
+      }
+    }
+
+    if (!found) {
+      throw error(mkldnn_invalid_arguments,
+            std::string("unknown op ") + op);
+    }
+  }
+
+  // Scratch pool and huge page counters, in bytes
+  static PyObject *pool_stats() {
+    auto stats = ideep::utils::scratch_allocator::stats();
+    return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K,s:K}",
+        "alloc_size", static_cast<unsigned long long>(stats.alloc_size),
+        "free_size", static_cast<unsigned long long>(stats.free_size),
+        "peak_size", static_cast<unsigned long long>(stats.peak_size),
+        "released_size", static_cast<unsigned long long>(stats.released_size),
+        "limit", static_cast<unsigned long long>(stats.limit),
+        "huge_page_mapped", static_cast<unsigned long long>(
+          ideep::utils::huge_page::mapped_size()),
+        "huge_page_backed", static_cast<unsigned long long>(
+          ideep::utils::huge_page::backed_size()));
+  }
+
+  // Release idle scratch blocks until at most target bytes are allocated
+  static void trim_pool(size_t target = 0) {
+    ideep::utils::scratch_allocator::trim(target);
+  }
+
+  // Scratch pool budget in bytes, 0 for unlimited
+  static void set_pool_limit(size_t limit) {
+    ideep::utils::scratch_allocator::set_limit(limit);
+  }
+
+  // Map new pool blocks of at least threshold bytes on 2MB pages
+  static void set_huge_page(bool enabled, size_t threshold = 2 << 20) {
+    ideep::utils::huge_page::threshold() = threshold;
+    ideep::utils::huge_page::set_enabled(enabled);
+  }
+
+  // Lazy fusion counters of every pattern, keyed by pattern name
+  static PyObject *fusion_report() {
+    using optimizer =
+      ideep::utils::computation_web::dag_optimizer<ideep::tensor>;
+    using fusion_type_t = optimizer::fusion_type_t;
+    PyObject *all = PyDict_New();
+    for (int i = 0; i < fusion_type_t::CN_FUSION_NA; i++) {
+      auto ftype = static_cast<fusion_type_t>(i);
+      if (ftype == fusion_type_t::CN_FUSION_CONV)
+        continue;
+      auto report = optimizer::report(ftype);
+      PyObject *item = Py_BuildValue("{s:K,s:K,s:O}",
+          "candidates", static_cast<unsigned long long>(report.candidates),
+          "fused", static_cast<unsigned long long>(report.fused),
+          "enabled", optimizer::is_enabled(ftype) ? Py_True : Py_False);
+      PyDict_SetItemString(all, optimizer::pattern_name(ftype), item);
+      Py_DECREF(item);
+    }
+    return all;
+  }
+
+  // Switch lazy fusion of pattern name, or of all patterns with "all"
+  static void set_fusion(const std::string &pattern, bool enabled) {
+    using optimizer =
+      ideep::utils::computation_web::dag_optimizer<ideep::tensor>;
+    using fusion_type_t = optimizer::fusion_type_t;
+    bool found = false;
+    for (int i = 0; i < fusion_type_t::CN_FUSION_NA; i++) {
+      auto ftype = static_cast<fusion_type_t>(i);
+      if (ftype != fusion_type_t::CN_FUSION_CONV &&
+          (pattern == "all" || pattern == optimizer::pattern_name(ftype))) {
+        optimizer::set_enabled(ftype, enabled);
+        found = true;
+      }
+    }
+
+    if (!found) {
+      throw error(mkldnn_invalid_arguments,
+            std::string("unknown fusion pattern ") + pattern);
+    }
+  }
+
+  // Run lazy computations on a background thread, batch nodes per job
+  static void set_async(bool enabled, size_t batch = 16) {
+    using executor =
+      ideep::utils::computation_web::async_executor<ideep::tensor>;
+    if (batch > 0)
+      executor::batch() = batch;
+    executor::set_enabled(enabled);
+  }
+
+  // Time direct and winograd convolution per shape and keep the faster,
+  // choices are read from and written to path when given
+  static void set_autotune(bool enabled, const std::string &path = "") {
+    if (!path.empty()) {
+      std::ifstream exists(path);
+      if (exists.good())
+        ideep::utils::tuning_table::load(path);
+    }
+    ideep::utils::tuning_table::set_path(path);
+    ideep::utils::tuning_table::set_enabled(enabled);
+  }
+
+  // Record a timeline of lazily fired computations
+  static void set_trace(bool enabled) {
+    ideep::utils::computation_web::tracer<ideep::tensor>::set_enabled(enabled);
+  }
+
+  // Write recorded computations as Chrome trace JSON, and forget them
+  static void dump_trace(const std::string &path) {
+    using tracer = ideep::utils::computation_web::tracer<ideep::tensor>;
+    if (!tracer::dump(path)) {
+      throw error(mkldnn_invalid_arguments,
+            std::string("could not write trace to ") + path);
+    }
+    tracer::clear();
+  }
+
+private:
+  struct cache_entry {
+    const char *name;
+    ideep::utils::cache_stats (*stats)();
+    void (*reset_stats)();
+    void (*set_capacity)(size_t);
+  };
+
+  template <class op_t>
+  static cache_entry cache_entry_of(const char *name) {
+    return {name, &op_t::stats, &op_t::reset_stats, &op_t::set_capacity};
+  }
+
+  static const std::vector<cache_entry> &cache_table() {
+    static const std::vector<cache_entry> table = {
+      cache_entry_of<ideep::reorder>("reorder"),
+      cache_entry_of<ideep::sum>("sum"),
+      cache_entry_of<ideep::convolution_forward>("convolution_forward"),
+      cache_entry_of<ideep::convolution_backward_data>(
+          "convolution_backward_data"),
+      cache_entry_of<ideep::convolution_backward_weights>(
+          "convolution_backward_weights"),
+      cache_entry_of<ideep::lrn_forward>("lrn_forward"),
+      cache_entry_of<ideep::lrn_backward>("lrn_backward"),
+      cache_entry_of<ideep::pooling_forward>("pooling_forward"),
+      cache_entry_of<ideep::pooling_backward>("pooling_backward"),
+      cache_entry_of<ideep::eltwise_forward>("eltwise_forward"),
+      cache_entry_of<ideep::eltwise_backward>("eltwise_backward"),
+      cache_entry_of<ideep::concat>("concat"),
+      cache_entry_of<ideep::batch_normalization_forward_inference>(
+          "batch_normalization_forward_inference"),
+      cache_entry_of<ideep::batch_normalization_forward_training>(
+          "batch_normalization_forward_training"),
+      cache_entry_of<ideep::batch_normalization_backward>(
+          "batch_normalization_backward"),
+      cache_entry_of<ideep::inner_product_forward>("inner_product_forward"),
+      cache_entry_of<ideep::inner_product_backward_data>(
+          "inner_product_backward_data"),
+      cache_entry_of<ideep::inner_product_backward_weights>(
+          "inner_product_backward_weights"),
+    };
+    return table;
+  }
 };
@@ -27,4 +27,5 @@
   #include "basic.h"
 %}
 
+%include "std_string.i"
 %include "basic.h"
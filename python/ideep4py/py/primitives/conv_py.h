@@ -67,6 +67,56 @@ public:
   }
 
 
+  // Convolution, bias, sum_scale * residual and an activation in one
+  // pass. The activation is relu with negative_slope, or relu bounded at
+  // upper_bound when that is positive. residual is left untouched.
+  static mdarray ForwardFused(mdarray *src,
+                              mdarray *weights,
+                              mdarray *bias,
+                              conv_param_t *cp,
+                              mdarray *residual,
+                              float sum_scale,
+                              bool relu,
+                              float negative_slope,
+                              float upper_bound) {
+    using post_ops = ideep::descriptor_group::post_ops;
+    post_ops epilogue;
+    tensor dst;
+    if (residual) {
+      dst.init<scratch_allocator, convolution_forward>(
+          {cp->out_dims, src->get()->get_data_type()});
+      ideep::reorder::compute(*(residual->get()), dst);
+      epilogue.append(ideep::kind::sum, sum_scale,
+          1.0, 0.0, ideep::algorithm::eltwise_relu);
+    }
+    if (upper_bound > 0.f)
+      epilogue.append(ideep::kind::eltwise, 1.0, upper_bound, 0.0,
+          ideep::algorithm::eltwise_bounded_relu);
+    else if (relu)
+      epilogue.append(ideep::kind::eltwise, 1.0, negative_slope, 0.0,
+          ideep::algorithm::eltwise_relu);
+
+    if (bias)
+      convolution_forward::compute<scratch_allocator>(
+          *(src->get()), *(weights->get()),
+          *(bias->get()), cp->out_dims, dst,
+          tensor::dims {cp->sy, cp->sx},
+          tensor::dims {cp->dilate_y, cp->dilate_x},
+          tensor::dims {cp->pad_lh, cp->pad_lw},
+          tensor::dims {cp->pad_rh, cp->pad_rw}, epilogue);
+    else
+      convolution_forward::compute<scratch_allocator>(
+          *(src->get()), *(weights->get()), cp->out_dims, dst,
+          tensor::dims {cp->sy, cp->sx},
+          tensor::dims {cp->dilate_y, cp->dilate_x},
+          tensor::dims {cp->pad_lh, cp->pad_lw},
+          tensor::dims {cp->pad_rh, cp->pad_rw}, epilogue);
+
+    auto out = mdarray(dst);
+    return out;
+  }
+
+
   static mdarray BackwardWeights(mdarray *src,
                                  mdarray *grady,
                                  conv_param_t *cp) {
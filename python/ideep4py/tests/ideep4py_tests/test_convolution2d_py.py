@@ -105,6 +105,32 @@ class TestConvolution2DPyF32(unittest.TestCase):
     def test_forward_cpu(self):
         self.check_forward(self.x, self.w, self.b, self.cp)
 
+    def check_forward_fused(self, x, w, b, cp, r):
+        y_act = convolution2D.ForwardFused(x, w, b, cp, r, sum_scale=0.5)
+        y_act = numpy.array(y_act, dtype=self.dtype)
+
+        x = numpy.array(x, dtype=self.dtype)
+        w = numpy.array(w, dtype=self.dtype)
+        b = numpy.array(b, dtype=self.dtype)
+        r = numpy.array(r, dtype=self.dtype)
+        kh, kw = w.shape[2:]
+        col = im2col_cpu(
+            x, kh, kw, self.sy, self.sx, self.ph, self.pw,
+            cover_all=self.cover_all, dy=self.dy, dx=self.dx)
+        y = numpy.tensordot(
+            col, w, ((1, 2, 3), (1, 2, 3))).astype(x.dtype, copy=False)
+        y += b
+        y_expect = numpy.maximum(numpy.rollaxis(y, 3, 1) + 0.5 * r, 0)
+        numpy.testing.assert_allclose(
+            y_act, y_expect, **self.check_forward_options)
+
+    def test_forward_fused_cpu(self):
+        r = numpy.array(self.gy, dtype=self.dtype)
+        self.check_forward_fused(self.x, self.w, self.b, self.cp, self.gy)
+        # The residual is an input only
+        numpy.testing.assert_array_equal(
+            numpy.array(self.gy, dtype=self.dtype), r)
+
     def check_backward_weights(self, x, w, b, cp, gy):
         gW_act, gB_act = convolution2D.BackwardWeightsBias(x, gy, cp)
         gW_act = numpy.array(gW_act, dtype=self.dtype)
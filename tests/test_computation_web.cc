@@ -0,0 +1,827 @@
+#define _IDEEP4PY_WEB_OPT_ true
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <omp.h>
+#include <gtest/gtest.h>
+#include "ideep/web.hpp"
+
+using web = ideep::utils::computation_web;
+
+// Heap allocations made by this process
+static std::atomic<size_t> allocations {0};
+
+void *operator new(size_t size) {
+  allocations ++;
+  if (void *p = malloc(size))
+    return p;
+  throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+// Minimal parameter, a shared integer stands in for the buffer
+struct fake_param : public web::parameter<fake_param> {
+  fake_param() : value_(std::make_shared<int>(0)) {}
+
+  bool computation_param_own_of_memory() const { return true; }
+  bool has_extra() const { return false; }
+  fake_param *get_extra() { return nullptr; }
+
+  bool operator==(const fake_param &p) const { return value_ == p.value_; }
+
+  size_t computation_param_size() const { return sizeof(int); }
+
+  std::vector<int> computation_param_dims() const { return {1}; }
+
+  std::shared_ptr<char> computation_param_buffer() const {
+    return std::shared_ptr<char>(value_, reinterpret_cast<char *>(value_.get()));
+  }
+
+  void computation_param_rebind(const std::shared_ptr<char>& buffer) {
+    value_ = std::shared_ptr<int>(buffer, reinterpret_cast<int *>(buffer.get()));
+  }
+
+  fake_param computation_param_clone() const {
+    fake_param clone;
+    clone.value_ = value_;
+    return clone;
+  }
+
+  void computation_param_attach(const fake_param &p) { value_ = p.value_; }
+
+  bool computation_param_compatible(const fake_param &) const { return true; }
+
+  int value() const {
+    web::parameter<fake_param>::computation_param_materialize(*this);
+    return *value_;
+  }
+
+  std::shared_ptr<int> value_;
+};
+
+using prop_kind_t = web::node<fake_param>::prop_kind_t;
+using fusion_type_t = web::node<fake_param>::fusion_type_t;
+using fusion_attr_t = web::node<fake_param>::fusion_attr_t;
+using fake_dag_build = web::dag_build<fake_param>;
+using fake_optimizer = web::dag_optimizer<fake_param>;
+using fake_scheduler = web::dag_scheduler<fake_param>;
+using fake_planner = web::dag_memory_planner<fake_param>;
+using fake_graph = web::graph<fake_param>;
+using fake_async = web::async_executor<fake_param>;
+using fake_session = web::session<fake_param>;
+using fake_tracer = web::tracer<fake_param>;
+
+// Sums its inputs plus a bias, and records firing order
+struct fake_op : public web::node<fake_param> {
+  fake_op(int bias, std::string *trace) : bias_(bias), trace_(trace) {}
+
+  virtual void fire_computation_node(
+      std::vector<fake_param>& deps, std::vector<fake_param>& tars) {
+    // Stands in for submitting the primitive
+    fake_graph::executed();
+    int sum = bias_;
+    for (auto &dep : deps)
+      sum += *dep.value_;
+    *tars[0].value_ = sum;
+    *trace_ += std::to_string(bias_);
+  }
+
+  static fake_param compute(int bias, std::string *trace,
+      std::vector<fake_param> deps,
+      fusion_type_t ftype = fusion_type_t::CN_FUSION_NA) {
+    fake_param dst;
+    fake_op op(bias, trace);
+    auto cn = web::computation_node<fake_op, fake_param>::create(
+        op, prop_kind_t::CN_PROP_FORWARD, fusion_attr_t{ftype, {}, {}}, dst);
+    EXPECT_TRUE(cn->build_deps(deps));
+    web::computation_node<fake_op, fake_param>::enqueue(cn);
+    return dst;
+  }
+
+  int bias_;
+  std::string *trace_;
+};
+
+TEST(computation_web_test, TestsChain) {
+  std::string trace;
+  fake_param src;
+  *src.value_ = 1;
+
+  auto a = fake_op::compute(1, &trace, {src});
+  auto b = fake_op::compute(2, &trace, {a});
+  auto c = fake_op::compute(3, &trace, {b});
+  ASSERT_EQ(fake_dag_build::num_dags(), 1);
+  ASSERT_EQ(trace, "");
+
+  ASSERT_EQ(c.value(), 7);
+  ASSERT_EQ(trace, "123");
+  ASSERT_TRUE(a.is_materialized() && b.is_materialized());
+  ASSERT_EQ(fake_dag_build::num_dags(), 0);
+}
+
+TEST(computation_web_test, TestsHiddenTensor) {
+  std::string trace;
+  fake_param src;
+
+  auto a = fake_op::compute(1, &trace, {src});
+  auto b = fake_op::compute(2, &trace, {a});
+  auto c = fake_op::compute(3, &trace, {b});
+
+  // Reading b splits off c, which runs later on its own
+  ASSERT_EQ(b.value(), 3);
+  ASSERT_EQ(trace, "12");
+  ASSERT_FALSE(c.is_materialized());
+  ASSERT_EQ(fake_dag_build::num_dags(), 1);
+
+  ASSERT_EQ(c.value(), 6);
+  ASSERT_EQ(trace, "123");
+  ASSERT_EQ(fake_dag_build::num_dags(), 0);
+}
+
+TEST(computation_web_test, TestsBranches) {
+  std::string trace;
+  fake_param src;
+
+  auto a = fake_op::compute(1, &trace, {src});
+  auto b = fake_op::compute(2, &trace, {a});
+  auto c = fake_op::compute(3, &trace, {a});
+  auto d = fake_op::compute(4, &trace, {b, c});
+  ASSERT_EQ(fake_dag_build::num_dags(), 3);
+
+  ASSERT_EQ(d.value(), 11);
+  ASSERT_TRUE(a.is_materialized() && b.is_materialized());
+  ASSERT_TRUE(c.is_materialized());
+  ASSERT_EQ(fake_dag_build::num_dags(), 0);
+}
+
+TEST(computation_web_test, TestsLongChain) {
+  std::string trace;
+  fake_param t;
+  for (int i = 0; i < 10000; i ++)
+    t = fake_op::compute(0, &trace, {t});
+  ASSERT_EQ(fake_dag_build::num_dags(), 1);
+  ASSERT_EQ(t.value(), 0);
+  ASSERT_EQ(trace.size(), 10000);
+}
+
+// Scales its input, fusing a following relu-typed op by adding its bias
+struct fake_conv : public web::node<fake_param> {
+  fake_conv(int scale, int post_bias, std::string *trace)
+    : scale_(scale), post_bias_(post_bias), trace_(trace) {}
+
+  virtual void fire_computation_node(
+      std::vector<fake_param>& deps, std::vector<fake_param>& tars) {
+    *tars[0].value_ = *deps[0].value_ * scale_ + post_bias_;
+    *trace_ += post_bias_ ? "C" : "c";
+  }
+
+  virtual cn_t fuse_if_necessary(std::shared_ptr<web::node<fake_param>>,
+      fusion_attr_t& tar_attr, fake_param& dst) {
+    if (tar_attr.ftype != fusion_type_t::CN_FUSION_RELU || post_bias_)
+      return nullptr;
+    fake_conv fused(scale_, relu_bias_, trace_);
+    auto cn = web::computation_node<fake_conv, fake_param>::create(fused,
+        prop_kind_t::CN_PROP_FORWARD, conv_attr(), dst);
+    EXPECT_TRUE(cn->build_deps(src_));
+    return cn;
+  }
+
+  static fake_param compute(int scale, std::string *trace,
+      const fake_param &src, int relu_bias) {
+    fake_param dst;
+    fake_conv op(scale, 0, trace);
+    op.src_ = src;
+    op.relu_bias_ = relu_bias;
+    auto cn = web::computation_node<fake_conv, fake_param>::create(
+        op, prop_kind_t::CN_PROP_FORWARD, conv_attr(), dst);
+    EXPECT_TRUE(cn->build_deps(src));
+    web::computation_node<fake_conv, fake_param>::enqueue(cn);
+    return dst;
+  }
+
+  static fusion_attr_t conv_attr() {
+    return fusion_attr_t{fusion_type_t::CN_FUSION_CONV, {}, {}};
+  }
+
+  int scale_, post_bias_, relu_bias_ = 0;
+  std::string *trace_;
+  fake_param src_;
+};
+
+TEST(computation_web_test, TestsFusion) {
+  std::string trace;
+  fake_param src;
+  *src.value_ = 2;
+  fake_optimizer::reset_report();
+
+  // The conv output is only read by the relu, fuse them
+  auto relu = fake_op::compute(5, &trace, {fake_conv::compute(
+      3, &trace, src, 5)}, fusion_type_t::CN_FUSION_RELU);
+  ASSERT_EQ(relu.value(), 11);
+  ASSERT_EQ(trace, "C");
+  ASSERT_EQ(fake_optimizer::report(fusion_type_t::CN_FUSION_RELU).fused, 1);
+
+  // A held conv output must be computed, leave the pair alone
+  trace.clear();
+  auto conv = fake_conv::compute(3, &trace, src, 5);
+  relu = fake_op::compute(5, &trace, {conv}, fusion_type_t::CN_FUSION_RELU);
+  ASSERT_EQ(relu.value(), 11);
+  ASSERT_EQ(trace, "c5");
+  ASSERT_EQ(conv.value(), 6);
+  ASSERT_EQ(fake_optimizer::report(fusion_type_t::CN_FUSION_RELU).fused, 1);
+
+  // Disabled pattern
+  trace.clear();
+  fake_optimizer::set_enabled(fusion_type_t::CN_FUSION_RELU, false);
+  relu = fake_op::compute(5, &trace, {fake_conv::compute(
+      3, &trace, src, 5)}, fusion_type_t::CN_FUSION_RELU);
+  ASSERT_EQ(relu.value(), 11);
+  ASSERT_EQ(trace, "c5");
+  fake_optimizer::set_enabled(fusion_type_t::CN_FUSION_RELU, true);
+
+  auto report = fake_optimizer::report(fusion_type_t::CN_FUSION_RELU);
+  ASSERT_EQ(report.candidates, 2);
+  ASSERT_EQ(report.fused, 1);
+  ASSERT_EQ(fake_dag_build::num_dags(), 0);
+}
+
+// Copies its input, and records the threads available while firing
+struct fake_probe : public web::node<fake_param> {
+  explicit fake_probe(int *nthr) : nthr_(nthr) {}
+
+  virtual void fire_computation_node(
+      std::vector<fake_param>& deps, std::vector<fake_param>& tars) {
+    *tars[0].value_ = *deps[0].value_ + 1;
+    *nthr_ = omp_get_max_threads();
+  }
+
+  static fake_param compute(int *nthr, const fake_param &src) {
+    fake_param dst;
+    fake_probe op(nthr);
+    auto cn = web::computation_node<fake_probe, fake_param>::create(
+        op, prop_kind_t::CN_PROP_FORWARD, dst);
+    EXPECT_TRUE(cn->build_deps(src));
+    web::computation_node<fake_probe, fake_param>::enqueue(cn);
+    return dst;
+  }
+
+  int *nthr_;
+};
+
+TEST(computation_web_test, TestsParallelBranches) {
+  int nthr = omp_get_max_threads();
+  std::string trace;
+  fake_param src1, src2;
+  *src1.value_ = 1;
+  *src2.value_ = 2;
+
+  // Two towers with no common input, joined at the end
+  std::vector<int> teams(4, 0);
+  auto a = fake_probe::compute(&teams[0], src1);
+  auto b = fake_probe::compute(&teams[1], a);
+  auto c = fake_probe::compute(&teams[2], src2);
+  auto d = fake_probe::compute(&teams[3], c);
+  auto e = fake_op::compute(0, &trace, {b, d});
+  ASSERT_EQ(fake_dag_build::num_dags(), 3);
+
+  ASSERT_EQ(e.value(), 7);
+  ASSERT_EQ(fake_dag_build::num_dags(), 0);
+  if (nthr > 1) {
+    ASSERT_EQ(teams[0], teams[1]);
+    ASSERT_EQ(teams[0] + teams[2], nthr);
+  }
+
+  // Sequential, every node sees all threads
+  fake_scheduler::set_enabled(false);
+  a = fake_probe::compute(&teams[0], src1);
+  c = fake_probe::compute(&teams[2], src2);
+  e = fake_op::compute(0, &trace, {a, c});
+  ASSERT_EQ(e.value(), 5);
+  ASSERT_EQ(teams[0], nthr);
+  ASSERT_EQ(teams[2], nthr);
+  fake_scheduler::set_enabled(true);
+}
+
+// Copies of one instance share its state, like the primitive of a cached
+// computation, and count overlapping firings
+struct fake_shared_state : public web::node<fake_param> {
+  struct state_t {
+    std::atomic<int> busy {0};
+    std::atomic<int> overlaps {0};
+  };
+
+  fake_shared_state() : state_(std::make_shared<state_t>()) {}
+
+  virtual void fire_computation_node(
+      std::vector<fake_param>& deps, std::vector<fake_param>& tars) {
+    if (state_->busy ++ != 0)
+      state_->overlaps ++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    *tars[0].value_ = *deps[0].value_ * 2;
+    state_->busy --;
+  }
+
+  fake_param compute(const fake_param &src) {
+    fake_param dst;
+    auto cn = web::computation_node<fake_shared_state, fake_param>::create(
+        *this, prop_kind_t::CN_PROP_FORWARD, dst);
+    EXPECT_TRUE(cn->build_deps(src));
+    web::computation_node<fake_shared_state, fake_param>::enqueue(cn);
+    return dst;
+  }
+
+  const state_t *get() const { return state_.get(); }
+
+  std::shared_ptr<state_t> state_;
+};
+
+TEST(computation_web_test, TestsParallelBranchesSharedState) {
+  std::string trace;
+  fake_shared_state same, other;
+  std::vector<fake_param> srcs(4);
+  for (int i = 0; i < 4; i ++)
+    *srcs[i].value_ = i;
+
+  // Four same-shape towers, two of them on one cached instance
+  auto a = same.compute(same.compute(srcs[0]));
+  auto b = same.compute(same.compute(srcs[1]));
+  auto c = other.compute(other.compute(srcs[2]));
+  auto d = fake_op::compute(0, &trace, {srcs[3]});
+  auto e = fake_op::compute(0, &trace, {a, b, c, d});
+  ASSERT_EQ(fake_dag_build::num_dags(), 5);
+
+  ASSERT_EQ(e.value(), 0 + 4 + 8 + 3);
+  ASSERT_EQ(same.state_->overlaps, 0);
+  ASSERT_EQ(other.state_->overlaps, 0);
+}
+
+TEST(computation_web_test, TestsDependencyLevels) {
+  std::string trace, trace2;
+  fake_param src;
+
+  // c reads a hidden tensor of the first dag, and d reads both
+  auto a = fake_op::compute(1, &trace, {src});
+  auto b = fake_op::compute(2, &trace, {a});
+  auto c = fake_op::compute(3, &trace2, {a});
+  auto d = fake_op::compute(4, &trace2, {b, c});
+
+  ASSERT_EQ(d.value(), 11);
+  ASSERT_EQ(trace, "12");
+  ASSERT_EQ(trace2, "34");
+  ASSERT_EQ(fake_dag_build::num_dags(), 0);
+}
+
+// Increments its input, may overwrite it
+struct fake_inc : public web::node<fake_param> {
+  virtual void fire_computation_node(
+      std::vector<fake_param>& deps, std::vector<fake_param>& tars) {
+    *tars[0].value_ = *deps[0].value_ + 1;
+  }
+
+  virtual bool can_compute_inplace() const { return true; }
+
+  static fake_param compute(const fake_param &src) {
+    fake_param dst;
+    fake_inc op;
+    auto cn = web::computation_node<fake_inc, fake_param>::create(
+        op, prop_kind_t::CN_PROP_FORWARD, dst);
+    EXPECT_TRUE(cn->build_deps(src));
+    web::computation_node<fake_inc, fake_param>::enqueue(cn);
+    return dst;
+  }
+};
+
+// Backward node, the weight gradient flavour has nothing reading it
+struct fake_grad : public web::node<fake_param> {
+  fake_grad(bool weight, int *nthr) : weight_(weight), nthr_(nthr) {}
+
+  virtual void fire_computation_node(
+      std::vector<fake_param>& deps, std::vector<fake_param>& tars) {
+    *tars[0].value_ = *deps[0].value_ * 2;
+    *nthr_ = omp_get_max_threads();
+  }
+
+  virtual bool computes_weight_gradient() const { return weight_; }
+
+  static fake_param compute(bool weight, int *nthr, const fake_param &src) {
+    fake_param dst;
+    fake_grad op(weight, nthr);
+    auto cn = web::computation_node<fake_grad, fake_param>::create(
+        op, prop_kind_t::CN_PROP_BACKWARD, dst);
+    EXPECT_TRUE(cn->build_deps(src));
+    web::computation_node<fake_grad, fake_param>::enqueue(cn);
+    return dst;
+  }
+
+  bool weight_;
+  int *nthr_;
+};
+
+TEST(computation_web_test, TestsWeightGradients) {
+  int nthr = omp_get_max_threads();
+  fake_param grady;
+  *grady.value_ = 1;
+
+  // Weight gradients branch off the data gradient chain
+  std::vector<int> teams(4, 0);
+  auto gradx1 = fake_grad::compute(false, &teams[0], grady);
+  auto gradw1 = fake_grad::compute(true, &teams[1], grady);
+  auto gradx2 = fake_grad::compute(false, &teams[2], gradx1);
+  auto gradw2 = fake_grad::compute(true, &teams[3], gradx1);
+  ASSERT_EQ(fake_dag_build::num_dags(), 3);
+
+  // Reading the data gradient runs the weight gradients alongside
+  ASSERT_EQ(gradx2.value(), 4);
+  ASSERT_EQ(fake_dag_build::num_dags(), 0);
+  ASSERT_EQ(gradw1.value(), 2);
+  ASSERT_EQ(gradw2.value(), 4);
+  if (nthr > 1) {
+    ASSERT_EQ(teams[0] + teams[1], nthr);
+    ASSERT_EQ(teams[2] + teams[3], nthr);
+  }
+}
+
+TEST(computation_web_test, TestsMemoryPlan) {
+  std::string trace;
+  fake_param src;
+  *src.value_ = 1;
+
+  // Dropped intermediates, the first and third share a buffer
+  fake_planner::reset_report();
+  auto t = src;
+  for (int i = 0; i < 4; i++)
+    t = fake_op::compute(1, &trace, {t});
+  ASSERT_EQ(t.value(), 5);
+  auto report = fake_planner::report();
+  ASSERT_EQ(report.tensors, 3);
+  ASSERT_EQ(report.slots, 2);
+  ASSERT_EQ(report.tensor_bytes, 3 * sizeof(int));
+  ASSERT_EQ(report.slot_bytes, 2 * sizeof(int));
+
+  // In place, every intermediate overwrites its source
+  fake_planner::reset_report();
+  t = src;
+  for (int i = 0; i < 4; i++)
+    t = fake_inc::compute(t);
+  ASSERT_EQ(t.value(), 5);
+  ASSERT_EQ(fake_planner::report().tensors, 3);
+  ASSERT_EQ(fake_planner::report().slots, 1);
+
+  // Held tensors keep their own buffer
+  fake_planner::reset_report();
+  auto a = fake_inc::compute(src);
+  auto b = fake_inc::compute(a);
+  t = fake_inc::compute(fake_inc::compute(b));
+  ASSERT_EQ(t.value(), 5);
+  ASSERT_EQ(a.value(), 2);
+  ASSERT_EQ(b.value(), 3);
+  ASSERT_EQ(fake_planner::report().tensors, 1);
+
+  fake_planner::set_enabled(false);
+  fake_planner::reset_report();
+  t = fake_inc::compute(fake_inc::compute(src));
+  ASSERT_EQ(t.value(), 3);
+  ASSERT_EQ(fake_planner::report().tensors, 0);
+  fake_planner::set_enabled(true);
+}
+
+TEST(computation_web_test, TestsCaptureReplay) {
+  std::string trace;
+  fake_param x;
+  *x.value_ = 1;
+
+  fake_graph::begin_capture();
+  auto y = fake_op::compute(1, &trace, {fake_op::compute(2, &trace, {x})});
+  auto g = fake_graph::end_capture("add3", {x}, {y});
+  ASSERT_TRUE(g != nullptr);
+  ASSERT_EQ(g->num_steps(), 2);
+  ASSERT_EQ(y.value(), 4);
+  ASSERT_EQ(trace, "21");
+
+  // Replay writes the new output only, no nodes are built
+  fake_param x2, y2;
+  *x2.value_ = 10;
+  trace.clear();
+  ASSERT_EQ(fake_graph::lookup("add3", {x2}), g);
+  ASSERT_TRUE(g->replay({x2}, {y2}));
+  ASSERT_EQ(*y2.value_, 13);
+  ASSERT_EQ(*y.value_, 4);
+  ASSERT_EQ(trace, "21");
+  ASSERT_EQ(fake_dag_build::num_dags(), 0);
+
+  *x2.value_ = 20;
+  ASSERT_TRUE(g->replay({x2}, {y2}));
+  ASSERT_EQ(*y2.value_, 23);
+
+  ASSERT_FALSE(g->replay({x2, x2}, {y2}));
+  ASSERT_TRUE(fake_graph::lookup("add4", {x2}) == nullptr);
+  fake_graph::clear_registry();
+  ASSERT_TRUE(fake_graph::lookup("add3", {x2}) == nullptr);
+}
+
+TEST(computation_web_test, TestsCaptureEagerCompute) {
+  std::string trace;
+  fake_param x;
+  *x.value_ = 1;
+
+  // An op computed outside the web leaves no step to replay
+  fake_graph::begin_capture();
+  auto a = fake_op::compute(1, &trace, {x});
+  ASSERT_EQ(a.value(), 2);
+  fake_param b;
+  std::vector<fake_param> deps {a}, tars {b};
+  fake_op(2, &trace).fire_computation_node(deps, tars);
+  auto y = fake_op::compute(3, &trace, {b});
+  ASSERT_TRUE(fake_graph::end_capture({x}, {y}) == nullptr);
+  ASSERT_EQ(y.value(), 7);
+  ASSERT_EQ(trace, "123");
+}
+
+TEST(computation_web_test, TestsAsyncExecutor) {
+  std::string trace;
+  fake_param src;
+  *src.value_ = 1;
+
+  fake_async::set_enabled(true);
+  auto batch = fake_async::batch();
+
+  // Below the batch size nothing is handed over until a read
+  fake_async::batch() = 16;
+  auto a = fake_op::compute(1, &trace, {src});
+  auto b = fake_op::compute(2, &trace, {a});
+  ASSERT_EQ(fake_dag_build::num_dags(), 1);
+  ASSERT_EQ(b.value(), 4);
+  ASSERT_EQ(trace, "12");
+  ASSERT_EQ(fake_dag_build::num_dags(), 0);
+
+  // One node per job, reads wait for the whole chain
+  fake_async::batch() = 1;
+  trace.clear();
+  auto t = src;
+  for (int i = 0; i < 100; i++)
+    t = fake_op::compute(1, &trace, {t});
+  auto u = fake_op::compute(0, &trace, {t, a});
+  ASSERT_EQ(u.value(), 103);
+  ASSERT_EQ(t.value(), 101);
+  ASSERT_EQ(trace.size(), 101);
+
+  fake_async::batch() = batch;
+  fake_async::set_enabled(false);
+  ASSERT_EQ(fake_dag_build::num_dags(), 0);
+}
+
+// Reads its input late, through a materializing read like ops do
+struct fake_slow : public web::node<fake_param> {
+  fake_slow(int bias) : bias_(bias) {}
+
+  virtual void fire_computation_node(
+      std::vector<fake_param>& deps, std::vector<fake_param>& tars) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    *tars[0].value_ = deps[0].value() + bias_;
+  }
+
+  static void compute(int bias, const fake_param& src, fake_param& dst) {
+    fake_slow op(bias);
+    auto cn = web::computation_node<fake_slow, fake_param>::create(
+        op, prop_kind_t::CN_PROP_FORWARD, fusion_attr_t{}, dst);
+    EXPECT_TRUE(cn->build_deps(src));
+    web::computation_node<fake_slow, fake_param>::enqueue(cn);
+  }
+
+  int bias_;
+};
+
+TEST(computation_web_test, TestsAsyncHazards) {
+  fake_param src;
+  *src.value_ = 1;
+
+  fake_async::set_enabled(true);
+  auto batch = fake_async::batch();
+
+  // A chain in one job, the second node reads the first on the worker
+  fake_async::batch() = 2;
+  fake_param a, b;
+  fake_slow::compute(1, src, a);
+  fake_slow::compute(1, a, b);
+
+  // Writing src from the host waits for the job reading it
+  fake_param::computation_param_materialize(src);
+  *src.value_ = 100;
+  ASSERT_EQ(b.value(), 3);
+
+  // Recomputing a tensor in flight isn't undone by the job finishing
+  fake_async::batch() = 1;
+  fake_slow::compute(1, src, a);
+  fake_async::batch() = 16;
+  fake_slow::compute(2, src, a);
+  std::this_thread::sleep_for(std::chrono::milliseconds(40));
+  ASSERT_EQ(a.value(), 102);
+
+  fake_async::batch() = batch;
+  fake_async::set_enabled(false);
+  ASSERT_EQ(fake_dag_build::num_dags(), 0);
+}
+
+TEST(computation_web_test, TestsThreadSessions) {
+  // Each thread builds its own dags
+  std::vector<std::thread> threads;
+  std::vector<int> values(4, 0);
+  std::vector<size_t> dags(4, 0);
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&, i] {
+      std::string trace;
+      fake_param t;
+      for (int j = 0; j < 1000; j++)
+        t = fake_op::compute(i, &trace, {t});
+      dags[i] = fake_dag_build::num_dags();
+      values[i] = t.value();
+    });
+  }
+  for (auto &th : threads)
+    th.join();
+  for (int i = 0; i < 4; i++) {
+    ASSERT_EQ(dags[i], 1);
+    ASSERT_EQ(values[i], 1000 * i);
+  }
+  ASSERT_EQ(fake_dag_build::num_dags(), 0);
+}
+
+TEST(computation_web_test, TestsExplicitSession) {
+  std::string trace;
+  fake_param src, b;
+  *src.value_ = 1;
+  auto s = fake_session::create();
+
+  // Enqueued on another thread into s, read here
+  std::thread([&] {
+    fake_session::scope bind(s);
+    auto a = fake_op::compute(1, &trace, {src});
+    b = fake_op::compute(2, &trace, {a});
+  }).join();
+  ASSERT_EQ(fake_dag_build::num_dags(), 0);
+  {
+    fake_session::scope bind(s);
+    ASSERT_EQ(fake_dag_build::num_dags(), 1);
+  }
+
+  // A pending tensor of s used in this thread's session is computed in s
+  auto c = fake_op::compute(3, &trace, {b});
+  ASSERT_EQ(trace, "12");
+  ASSERT_EQ(c.value(), 7);
+
+  // Dropping a session runs what it left pending
+  trace.clear();
+  fake_param d;
+  {
+    fake_session::scope bind(s);
+    d = fake_op::compute(4, &trace, {src});
+  }
+  s.reset();
+  ASSERT_EQ(trace, "4");
+  ASSERT_EQ(*d.value_, 5);
+}
+
+TEST(computation_web_test, TestsConcurrentReads) {
+  std::string trace;
+  fake_param src, b;
+  *src.value_ = 1;
+  auto s = fake_session::create();
+  {
+    fake_session::scope bind(s);
+    b = fake_op::compute(2, &trace, {fake_op::compute(1, &trace, {src})});
+  }
+
+  // Readers on several threads compute b once, in s
+  std::vector<std::thread> threads;
+  std::vector<int> values(4, 0);
+  for (int i = 0; i < 4; i++)
+    threads.emplace_back([&, i] { values[i] = b.value(); });
+  for (auto &th : threads)
+    th.join();
+  for (auto value : values)
+    ASSERT_EQ(value, 4);
+  ASSERT_EQ(trace, "12");
+}
+
+TEST(computation_web_test, TestsNodeAllocation) {
+  fake_param src, dst;
+  auto create = [&] {
+    fake_op op(0, nullptr);
+    auto cn = web::computation_node<fake_op, fake_param>::create(
+        op, prop_kind_t::CN_PROP_FORWARD, dst);
+    EXPECT_TRUE(cn->build_deps(src, src));
+    return cn;
+  };
+
+  // Once pools are warm, building a node takes nothing from the heap
+  for (int i = 0; i < 2; i++)
+    create()->clear();
+  auto before = allocations.load();
+  auto cn = create();
+  ASSERT_EQ(allocations.load() - before, 0);
+  ASSERT_EQ(cn->deps().size(), 2);
+  cn->clear();
+}
+
+TEST(computation_web_test, TestsCrossThreadFree) {
+  // Blocks freed on another thread come back through the shared depot
+  using allocator = web::pool_allocator<fake_param>;
+  std::vector<fake_param *> blocks;
+  for (int i = 0; i < 4096; i++)
+    blocks.push_back(allocator().allocate(1));
+  std::thread([&] {
+    for (auto b : blocks)
+      allocator().deallocate(b, 1);
+  }).join();
+
+  // The freeing thread keeps at most one list's worth
+  auto before = allocations.load();
+  for (auto& b : blocks)
+    b = allocator().allocate(1);
+  ASSERT_LE(allocations.load() - before, 1024);
+  for (auto b : blocks)
+    allocator().deallocate(b, 1);
+}
+
+TEST(computation_web_test, TestsTrace) {
+  std::string trace;
+  fake_param src;
+  *src.value_ = 2;
+  fake_tracer::set_enabled(true);
+  fake_tracer::clear();
+
+  auto relu = fake_op::compute(5, &trace, {fake_conv::compute(
+      3, &trace, src, 5)}, fusion_type_t::CN_FUSION_RELU);
+  auto out = fake_op::compute(1, &trace, {relu, src});
+  ASSERT_EQ(out.value(), 14);
+  fake_tracer::set_enabled(false);
+
+  // The fused conv, then the sum
+  auto events = fake_tracer::events();
+  ASSERT_EQ(events.size(), 2);
+  ASSERT_EQ(fake_tracer::type_name(events[0].type), "fake_conv");
+  ASSERT_TRUE(events[0].fused);
+  ASSERT_EQ(events[0].dims, "1 -> 1");
+  ASSERT_EQ(fake_tracer::type_name(events[1].type), "fake_op");
+  ASSERT_FALSE(events[1].fused);
+  ASSERT_EQ(events[1].dims, "1 1 -> 1");
+  ASSERT_LE(events[0].begin, events[0].end);
+  ASSERT_LE(events[0].end, events[1].begin);
+
+  std::ostringstream os;
+  fake_tracer::dump(os);
+  auto json = os.str();
+  ASSERT_EQ(json.find("{\"traceEvents\":["), 0);
+  ASSERT_NE(json.find("\"name\":\"fake_conv\",\"cat\":\"web\",\"ph\":\"X\""),
+      std::string::npos);
+  ASSERT_NE(json.find("\"fused\":true"), std::string::npos);
+
+  // Nothing is recorded while disabled
+  out = fake_op::compute(1, &trace, {src});
+  ASSERT_EQ(out.value(), 3);
+  ASSERT_EQ(fake_tracer::events().size(), 2);
+  fake_tracer::clear();
+}
+
+// Stands in for an op whose primitive cache is process-wide
+struct fake_shared_op : public fake_op {
+  using fake_op::fake_op;
+
+  static bool is_shared() { return shared; }
+  static bool shared;
+};
+
+bool fake_shared_op::shared = false;
+
+TEST(computation_web_test, TestsSharedCacheComputesEagerly) {
+  std::string trace;
+  fake_param src, dst;
+  fake_shared_op op(1, &trace);
+
+  fake_shared_op::shared = true;
+  auto cn = web::computation_node<fake_shared_op, fake_param>::create(
+      op, prop_kind_t::CN_PROP_FORWARD, dst);
+  ASSERT_FALSE(cn->build_deps(src));
+  ASSERT_TRUE(dst.is_materialized());
+  ASSERT_EQ(fake_dag_build::num_dags(), 0);
+
+  fake_shared_op::shared = false;
+  cn = web::computation_node<fake_shared_op, fake_param>::create(
+      op, prop_kind_t::CN_PROP_FORWARD, dst);
+  ASSERT_TRUE(cn->build_deps(src));
+  web::computation_node<fake_shared_op, fake_param>::enqueue(cn);
+  ASSERT_EQ(dst.value(), 1);
+  ASSERT_EQ(trace, "1");
+}
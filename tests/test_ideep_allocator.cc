@@ -22,7 +22,9 @@
  */
 
 
+#include <limits>
 #include <numeric>
+#include <thread>
 #include <mkldnn_test_common.hpp>
 #include <gtest/gtest.h>
 #include <ideep.hpp>
@@ -151,3 +153,133 @@ INSTANTIATE_TEST_CASE_P(
   allocator_test_params_float{ allocator_test_params_float::scratch_alloc,
   { 256, 256, 96, 9, 1 } }
 ));
+
+TEST(slab_pool_test, TestsSizeClass) {
+  size_t class_size;
+  for (size_t size = 1; size < (size_t(1) << 34); size = size * 3 / 2 + 1) {
+    auto cls = utils::slab_pool::size_class(size, class_size);
+    ASSERT_GE(class_size, size);
+    ASSERT_LE(class_size, size * 5 / 4 + utils::slab_pool::min_class_size);
+    ASSERT_EQ(utils::slab_pool::class_to_size(cls), class_size);
+    ASSERT_TRUE(cls < utils::slab_pool::num_classes);
+  }
+
+  // Past the largest class requests are not pooled
+  auto largest = utils::slab_pool::class_to_size(
+      utils::slab_pool::num_classes - 1);
+  ASSERT_EQ(utils::slab_pool::size_class(largest, class_size),
+      utils::slab_pool::num_classes - 1);
+  ASSERT_EQ(utils::slab_pool::size_class(largest + 1, class_size), -1);
+  ASSERT_EQ(utils::slab_pool::size_class(
+        std::numeric_limits<size_t>::max(), class_size), -1);
+  ASSERT_THROW(utils::slab_pool::instance()->malloc(
+        std::numeric_limits<size_t>::max()), std::invalid_argument);
+}
+
+TEST(slab_pool_test, TestsCrossThreadReuse) {
+  auto pool = utils::slab_pool::instance();
+
+  // Sizes in the same class share a block
+  auto p1 = pool->malloc(3000);
+  pool->free(p1);
+  auto p2 = pool->malloc(3050);
+  ASSERT_EQ(p1, p2);
+  ASSERT_EQ(reinterpret_cast<size_t>(p2) % SYS_MEMORY_ALIGNMENT, 0);
+
+  // Blocks cached by an exited thread return through the depot
+  void *p3 = nullptr;
+  std::thread([&] { p3 = pool->malloc(5 << 22); }).join();
+  std::thread([&] { pool->free(p3); }).join();
+  auto p4 = pool->malloc((5 << 22) - 100);
+  ASSERT_EQ(p3, p4);
+
+  pool->free(p2);
+  pool->free(p4);
+}
+
+TEST(slab_pool_test, TestsTrim) {
+  auto pool = utils::slab_pool::instance();
+
+  std::vector<void *> blocks;
+  for (int i = 0; i < 8; i ++)
+    blocks.push_back(pool->malloc(3 << 20));
+  for (auto p : blocks)
+    pool->free(p);
+
+  auto before = pool->stats();
+  ASSERT_GE(before.free_size, size_t(8 * (3 << 20)));
+  ASSERT_GE(before.peak_size, before.alloc_size);
+
+  pool->trim();
+  auto after = pool->stats();
+  ASSERT_EQ(after.free_size, 0);
+  ASSERT_EQ(after.alloc_size, before.alloc_size - before.free_size);
+  ASSERT_EQ(after.released_size - before.released_size, before.free_size);
+
+  // Idle blocks beyond the limit are released as they are freed
+  pool->set_limit(after.alloc_size + (4 << 20));
+  for (int i = 0; i < 8; i ++)
+    blocks[i] = pool->malloc(3 << 20);
+  for (auto p : blocks)
+    pool->free(p);
+  ASSERT_LE(pool->stats().alloc_size, after.alloc_size + (4 << 20));
+  pool->set_limit(0);
+}
+
+TEST(numa_allocator_test, TestsNodeLocalPool) {
+  using numa_alloc = utils::numa_allocator;
+  ASSERT_GE(utils::numa::num_nodes(), 1);
+
+  // Stay on one cpu, so the node can't change under the pool lookups
+#ifdef __linux__
+  cpu_set_t saved, here;
+  ASSERT_EQ(sched_getaffinity(0, sizeof(saved), &saved), 0);
+  CPU_ZERO(&here);
+  CPU_SET(sched_getcpu(), &here);
+  ASSERT_EQ(sched_setaffinity(0, sizeof(here), &here), 0);
+#endif
+
+  auto node = utils::numa::current_node();
+  auto p1 = numa_alloc::malloc<convolution_forward>(4900);
+  auto local = utils::slab_pool::of(p1) == numa_alloc::get_pool(node);
+  numa_alloc::free<convolution_forward>(p1);
+  auto p2 = numa_alloc::malloc<convolution_forward>(5000);
+#ifdef __linux__
+  sched_setaffinity(0, sizeof(saved), &saved);
+#endif
+  ASSERT_TRUE(local);
+  ASSERT_EQ(p1, p2);
+  numa_alloc::free<convolution_forward>(p2);
+
+  auto w = utils::interleave_allocator::malloc<convolution_forward>(1 << 22);
+  ASSERT_TRUE(w != nullptr);
+  std::memset(w, 0, 1 << 22);
+  utils::interleave_allocator::free<convolution_forward>(w);
+
+  tensor src;
+  src.init<utils::numa_allocator, convolution_forward>(
+      tensor::descriptor({8, 32, 13, 13}, tensor::data_type::f32));
+  ASSERT_TRUE(src.get_data_handle() != nullptr);
+}
+
+TEST(huge_page_allocator_test, TestsBackedSize) {
+  using huge_alloc = utils::huge_page_allocator;
+  auto before = utils::huge_page::mapped_size();
+
+  auto large = huge_alloc::malloc<convolution_forward>(4 << 20);
+  auto small = huge_alloc::malloc<convolution_forward>(4096);
+  ASSERT_TRUE(large != nullptr && small != nullptr);
+  ASSERT_EQ(reinterpret_cast<size_t>(large) % SYS_MEMORY_ALIGNMENT, 0);
+  std::memset(large, 0, 4 << 20);
+  std::memset(small, 0, 4096);
+
+  // Mapping may be refused, backing is up to the kernel
+  auto mapped = utils::huge_page::mapped_size() - before;
+  ASSERT_TRUE(mapped == 0 || mapped == 4 << 20);
+  ASSERT_LE(utils::huge_page::backed_size(),
+      utils::huge_page::mapped_size());
+
+  huge_alloc::free<convolution_forward>(large);
+  huge_alloc::free<convolution_forward>(small);
+  ASSERT_EQ(utils::huge_page::mapped_size(), before);
+}
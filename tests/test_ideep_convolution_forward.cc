@@ -1,4 +1,6 @@
+#include <cmath>
 #include <numeric>
+#include <thread>
 #include <mkldnn_test_common.hpp>
 #include <gtest/gtest.h>
 #include <ideep.hpp>
@@ -73,6 +75,69 @@ protected:
     dst_dims_ = {cd.mb, cd.oc, cd.oh, cd.ow};
   }
 
+  // Folded convolution against convolution then batch normalization
+  void TestBatchNormFolding() {
+    test_convolution_params_t p =
+      ::testing::TestWithParam<test_convolution_params_t>::GetParam();
+    test_convolution_sizes_t cd = p.sizes;
+    const float epsilon = 1e-5f;
+
+    tensor::descriptor stat_desc({cd.oc}, tensor::data_type::f32, format::x);
+    tensor mean, var, scale, shift, dst;
+    auto test = [&]() {
+      TestCommon();
+      for (auto t : {&mean, &var, &scale, &shift}) {
+        t->init(stat_desc);
+        fill_tensor(*t);
+      }
+      auto v = static_cast<float *>(var.get_data_handle());
+      for (int o = 0; o < cd.oc; o++)
+        v[o] = std::abs(v[o]);
+
+      auto folded = with_bias_ ?
+        convolution_forward::fold_batch_normalization(src_.get_dims(),
+            weights_, bias_, mean, var, scale, shift, epsilon, dst_dims_,
+            tensor::dims {cd.strh, cd.strw},
+            tensor::dims {cd.dilh, cd.dilw},
+            tensor::dims {cd.padh, cd.padw}, padR_) :
+        convolution_forward::fold_batch_normalization(src_.get_dims(),
+            weights_, mean, var, scale, shift, epsilon, dst_dims_,
+            tensor::dims {cd.strh, cd.strw},
+            tensor::dims {cd.dilh, cd.dilw},
+            tensor::dims {cd.padh, cd.padw}, padR_);
+      convolution_forward::compute(src_, folded[0], folded[1], dst_dims_,
+          dst, tensor::dims {cd.strh, cd.strw },
+          tensor::dims {cd.dilh, cd.dilw}, tensor::dims {cd.padh, cd.padw },
+          padR_);
+    };
+
+    if (catch_ideep_expected_failures(
+          test, p.expect_to_fail, p.expected_status))
+      return;
+
+    // Convolution, then batch normalization on plain nchw
+    tensor ref_dst({dst_dims_, tensor::data_type::f32, format::nchw});
+    test_convolution_attr_t attr = p.attr;
+    attr.mkldnn_attr_recreate();
+    compute_ref_conv_fwd<float, float, float, float>(
+        cd, attr, src_, weights_, bias_, ref_dst);
+
+    auto y = static_cast<float *>(ref_dst.get_data_handle());
+    auto m = static_cast<float *>(mean.get_data_handle());
+    auto v = static_cast<float *>(var.get_data_handle());
+    auto g = static_cast<float *>(scale.get_data_handle());
+    auto b = static_cast<float *>(shift.get_data_handle());
+    int spatial = cd.oh * cd.ow;
+    for (int n = 0; n < cd.mb; n++)
+      for (int o = 0; o < cd.oc; o++)
+        for (int i = 0; i < spatial; i++) {
+          auto& e = y[(n * cd.oc + o) * spatial + i];
+          e = (e - m[o]) * g[o] / std::sqrt(v[o] + epsilon) + b[o];
+        }
+
+    compare_tensor<float>(ref_dst, dst);
+  }
+
   tensor src_, weights_, bias_;
   tensor::dims dst_dims_;
   tensor::dims padR_;
@@ -83,6 +148,9 @@ protected:
 using convolution_test =
     convolution_forward_tests<float, float, float, float>;
 
+// Dilated shapes, only checked through batch normalization folding
+class dilated_convolution_test : public convolution_test {};
+
 // Test for moving, copy, cache behavior
 // Test for moving, copy, cache behavior
 TEST_P(convolution_test, TestManipulation) {
@@ -90,7 +158,7 @@ TEST_P(convolution_test, TestManipulation) {
   test_convolution_params_t p =
     ::testing::TestWithParam<test_convolution_params_t>::GetParam();
   test_convolution_sizes_t cd = p.sizes;
-  utils::bytestring key;
+  ideep::key_t key;
   convolution_forward comp;
 
   auto test = [&]() {
@@ -159,6 +227,279 @@ TEST_P(convolution_test, TestCompute) {
   compare_tensor<float>(ref_dst, dst);
 }
 
+TEST_P(convolution_test, TestSharedCache) {
+  test_convolution_params_t p =
+    ::testing::TestWithParam<test_convolution_params_t>::GetParam();
+  test_convolution_sizes_t cd = p.sizes;
+
+  auto run = [&](tensor& dst) {
+    if(with_bias_)
+      convolution_forward::compute(src_, weights_, bias_, dst_dims_, dst,
+          tensor::dims {cd.strh, cd.strw },
+          tensor::dims {cd.dilh, cd.dilw}, tensor::dims {cd.padh, cd.padw },
+          padR_);
+    else
+      convolution_forward::compute(src_, weights_, dst_dims_, dst,
+          tensor::dims {cd.strh, cd.strw },
+          tensor::dims {cd.dilh, cd.dilw}, tensor::dims {cd.padh, cd.padw },
+          padR_);
+  };
+
+  convolution_forward::set_shared(true);
+  auto dst = make_output();
+  auto test = [&]() {
+    TestCommon();
+    run(dst);
+  };
+
+  auto failed =
+    catch_ideep_expected_failures(test, p.expect_to_fail, p.expected_status);
+  if (failed) {
+    convolution_forward::set_shared(false);
+    return;
+  }
+
+  // Threads racing for the same instances, each has to see its own result
+  const int nthreads = 4;
+  std::vector<tensor> dsts(nthreads);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < nthreads; t++) {
+    workers.emplace_back([&, t]() {
+      for (int i = 0; i < 8; i++) {
+        dsts[t] = make_output();
+        run(dsts[t]);
+      }
+    });
+  }
+  for (auto& w : workers)
+    w.join();
+  convolution_forward::set_shared(false);
+
+  tensor ref_dst(dst.get_descriptor());
+  test_convolution_attr_t attr = p.attr;
+  attr.mkldnn_attr_recreate();
+  compute_ref_conv_fwd<float, float, float, float>(
+      cd, attr, src_, weights_, bias_, ref_dst);
+
+  compare_tensor<float>(ref_dst, dst);
+  for (auto& d : dsts)
+    compare_tensor<float>(ref_dst, d);
+}
+
+TEST_P(convolution_test, TestPrepackedWeights) {
+  test_convolution_params_t p =
+    ::testing::TestWithParam<test_convolution_params_t>::GetParam();
+  test_convolution_sizes_t cd = p.sizes;
+
+  tensor packed, dst;
+  auto test = [&]() {
+    TestCommon();
+    packed = convolution_forward::prepack_weights(src_.get_dims(),
+        weights_, dst_dims_, tensor::dims {cd.strh, cd.strw},
+        tensor::dims {cd.dilh, cd.dilw}, tensor::dims {cd.padh, cd.padw},
+        padR_);
+    if(with_bias_)
+      convolution_forward::compute(src_, packed, bias_, dst_dims_, dst,
+          tensor::dims {cd.strh, cd.strw },
+          tensor::dims {cd.dilh, cd.dilw}, tensor::dims {cd.padh, cd.padw },
+          padR_);
+    else
+      convolution_forward::compute(src_, packed, dst_dims_, dst,
+          tensor::dims {cd.strh, cd.strw },
+          tensor::dims {cd.dilh, cd.dilw}, tensor::dims {cd.padh, cd.padw },
+          padR_);
+  };
+
+  if (catch_ideep_expected_failures(test, p.expect_to_fail, p.expected_status))
+    return;
+
+  // Packing packed weights is a no-op
+  auto again = convolution_forward::prepack_weights(src_.get_dims(),
+      packed, dst_dims_, tensor::dims {cd.strh, cd.strw},
+      tensor::dims {cd.dilh, cd.dilw}, tensor::dims {cd.padh, cd.padw},
+      padR_);
+  EXPECT_EQ(again.get_data_handle(), packed.get_data_handle());
+
+  // Int8 weights are quantized with their scales, not prepacked
+  tensor s8_weights({weights_.get_dims(), tensor::data_type::s8});
+  EXPECT_THROW(convolution_forward::prepack_weights(src_.get_dims(),
+      s8_weights, dst_dims_, tensor::dims {cd.strh, cd.strw},
+      tensor::dims {cd.dilh, cd.dilw}, tensor::dims {cd.padh, cd.padw},
+      padR_), error);
+
+  tensor ref_dst(dst.get_descriptor());
+  test_convolution_attr_t attr = p.attr;
+  attr.mkldnn_attr_recreate();
+  compute_ref_conv_fwd<float, float, float, float>(
+      cd, attr, src_, weights_, bias_, ref_dst);
+
+  compare_tensor<float>(ref_dst, dst);
+}
+
+TEST_P(convolution_test, TestAutotune) {
+  test_convolution_params_t p =
+    ::testing::TestWithParam<test_convolution_params_t>::GetParam();
+  test_convolution_sizes_t cd = p.sizes;
+
+  // Tuning runs when a computation is created, so start with none cached
+  utils::tuning_table::set_enabled(true);
+  utils::tuning_table::clear();
+  convolution_forward::t_store().clear();
+  auto dst = make_output();
+  auto test = [&]() {
+    TestCommon();
+    if(with_bias_)
+      convolution_forward::compute(src_, weights_, bias_, dst_dims_, dst,
+          tensor::dims {cd.strh, cd.strw },
+          tensor::dims {cd.dilh, cd.dilw}, tensor::dims {cd.padh, cd.padw },
+          padR_);
+    else
+      convolution_forward::compute(src_, weights_, dst_dims_, dst,
+          tensor::dims {cd.strh, cd.strw },
+          tensor::dims {cd.dilh, cd.dilw}, tensor::dims {cd.padh, cd.padw },
+          padR_);
+  };
+
+  auto failed =
+    catch_ideep_expected_failures(test, p.expect_to_fail, p.expected_status);
+  utils::tuning_table::set_enabled(false);
+  if (failed)
+    return;
+
+  // Whichever algorithm won, the result is the same
+  EXPECT_EQ(utils::tuning_table::size(), 1u);
+  tensor ref_dst(dst.get_descriptor());
+  test_convolution_attr_t attr = p.attr;
+  attr.mkldnn_attr_recreate();
+  compute_ref_conv_fwd<float, float, float, float>(
+      cd, attr, src_, weights_, bias_, ref_dst);
+
+  compare_tensor<float>(ref_dst, dst);
+}
+
+TEST_P(convolution_test, TestFusedEpilogue) {
+  test_convolution_params_t p =
+    ::testing::TestWithParam<test_convolution_params_t>::GetParam();
+  test_convolution_sizes_t cd = p.sizes;
+  const float sum_scale = 0.5f;
+
+  tensor residual, dst;
+  auto test = [&]() {
+    TestCommon();
+    residual.init({dst_dims_, tensor::data_type::f32, format::nchw});
+    fill_tensor(residual);
+    dst.init(residual.get_descriptor());
+    reorder::compute(residual, dst);
+
+    // relu(conv + bias + sum_scale * dst), dst accumulated in place
+    auto epilogue = descriptor_group::post_ops::residual(sum_scale);
+    if (with_bias_)
+      convolution_forward::compute(src_, weights_, bias_, dst_dims_, dst,
+          tensor::dims {cd.strh, cd.strw },
+          tensor::dims {cd.dilh, cd.dilw}, tensor::dims {cd.padh, cd.padw },
+          padR_, epilogue);
+    else
+      convolution_forward::compute(src_, weights_, dst_dims_, dst,
+          tensor::dims {cd.strh, cd.strw },
+          tensor::dims {cd.dilh, cd.dilw}, tensor::dims {cd.padh, cd.padw },
+          padR_, epilogue);
+  };
+
+  if (catch_ideep_expected_failures(test, p.expect_to_fail, p.expected_status))
+    return;
+
+  tensor ref_dst(residual.get_descriptor());
+  test_convolution_attr_t attr = p.attr;
+  attr.mkldnn_attr_recreate();
+  compute_ref_conv_fwd<float, float, float, float>(
+      cd, attr, src_, weights_, bias_, ref_dst);
+
+  auto y = static_cast<float *>(ref_dst.get_data_handle());
+  auto r = static_cast<float *>(residual.get_data_handle());
+  for (size_t i = 0; i < ref_dst.get_nelems(); i++)
+    y[i] = std::max(y[i] + sum_scale * r[i], 0.f);
+
+  compare_tensor<float>(ref_dst, dst);
+
+  // A blocked residual is accumulated in its own format, in place
+  if (cd.oc % 8 != 0)
+    return;
+  tensor blocked({dst_dims_, tensor::data_type::f32, format::nChw8c});
+  reorder::compute(residual, blocked);
+  auto handle = blocked.get_data_handle();
+  auto epilogue = descriptor_group::post_ops::residual(sum_scale);
+  if (with_bias_)
+    convolution_forward::compute(src_, weights_, bias_, dst_dims_, blocked,
+        tensor::dims {cd.strh, cd.strw },
+        tensor::dims {cd.dilh, cd.dilw}, tensor::dims {cd.padh, cd.padw },
+        padR_, epilogue);
+  else
+    convolution_forward::compute(src_, weights_, dst_dims_, blocked,
+        tensor::dims {cd.strh, cd.strw },
+        tensor::dims {cd.dilh, cd.dilw}, tensor::dims {cd.padh, cd.padw },
+        padR_, epilogue);
+  EXPECT_EQ(blocked.get_data_handle(), handle);
+  compare_tensor<float>(ref_dst, blocked);
+}
+
+TEST_P(convolution_test, TestBatchNormFolding) {
+  TestBatchNormFolding();
+}
+
+TEST_P(convolution_test, TestChannelsLast) {
+  test_convolution_params_t p =
+    ::testing::TestWithParam<test_convolution_params_t>::GetParam();
+  test_convolution_sizes_t cd = p.sizes;
+
+  tensor src, dst, y;
+  bool public_dst = false;
+  auto test = [&]() {
+    TestCommon();
+    // Fed as an image decoder hands it over
+    src.init({src_.get_dims(), src_.get_data_type(), format::nhwc});
+    reorder::compute(src_, src);
+    if (with_bias_)
+      convolution_forward::compute(src, weights_, bias_, dst_dims_, dst,
+          tensor::dims {cd.strh, cd.strw },
+          tensor::dims {cd.dilh, cd.dilw}, tensor::dims {cd.padh, cd.padw },
+          padR_);
+    else
+      convolution_forward::compute(src, weights_, dst_dims_, dst,
+          tensor::dims {cd.strh, cd.strw },
+          tensor::dims {cd.dilh, cd.dilw}, tensor::dims {cd.padh, cd.padw },
+          padR_);
+    eltwise_forward::compute(dst, y);
+    public_dst = dst.is_public_format();
+  };
+
+  engine::set_channels_last(true);
+  auto failed =
+    catch_ideep_expected_failures(test, p.expect_to_fail, p.expected_status);
+  engine::set_channels_last(false);
+  if (failed)
+    return;
+
+  EXPECT_EQ(dst.get_internal_format(), format::nhwc);
+  EXPECT_EQ(y.get_internal_format(), format::nhwc);
+  EXPECT_TRUE(public_dst);
+
+  // The default mode doesn't pick up the channels-last computation
+  tensor default_dst;
+  convolution_forward::compute(src, weights_, dst_dims_, default_dst,
+      tensor::dims {cd.strh, cd.strw },
+      tensor::dims {cd.dilh, cd.dilw}, tensor::dims {cd.padh, cd.padw },
+      padR_);
+  EXPECT_NE(default_dst.get_internal_format(), format::nhwc);
+
+  tensor ref_dst(dst.get_descriptor());
+  test_convolution_attr_t attr = p.attr;
+  attr.mkldnn_attr_recreate();
+  compute_ref_conv_fwd<float, float, float, float>(
+      cd, attr, src, weights_, bias_, ref_dst);
+
+  compare_tensor<float>(ref_dst, dst);
+}
+
 // TEST_P(convolution_test, TestWeightsDeduction) {
 //   convolution_forward empty;
 //   tensor::descriptor dst_desc(dst_dims_, src_.get_data_type());
@@ -191,3 +532,12 @@ TEST_P(convolution_test, TestCompute) {
 #define DIRECTION_FORWARD
 #include "convolution_common.h"
 // #include "dilated_convolution.h"
+
+INSTANTIATE_TEST_CASE_P(TestConvolutionDilated, dilated_convolution_test,
+    ::testing::Values(
+      PARAMS(nchw, oihw, FMT_BIAS, nchw,
+          2, 1, 4, 8, 8, 6, 8, 8, 3, 3, 2, 2, 1, 1, 1, 1),
+      PARAMS(nchw, goihw, FMT_BIAS, nchw,
+          2, 2, 4, 10, 10, 6, 5, 5, 3, 3, 3, 3, 2, 2, 2, 2),
+      PARAMS(FMT_DATA_BLOCKED, FMT_WEIGHTS_BLOCKED, FMT_BIAS, FMT_DATA_BLOCKED,
+          2, 1, 32, 15, 15, 32, 9, 9, 3, 3, 0, 0, 1, 1, 2, 2)));
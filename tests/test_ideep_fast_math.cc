@@ -0,0 +1,106 @@
+#include <numeric>
+#include <mkldnn_test_common.hpp>
+#include <gtest/gtest.h>
+#include <ideep.hpp>
+#include "test_ideep_common.hpp"
+
+using namespace ideep;
+
+struct fast_math_test_params {
+  mkldnn::memory::dims dims;
+};
+
+template <typename data_t>
+class fast_math_tests:
+  public ::testing::TestWithParam<fast_math_test_params> {
+protected:
+  void TestCommon() {
+    auto p = ::testing::TestWithParam<fast_math_test_params>::GetParam();
+    tensor::descriptor desc(static_cast<tensor::dims>(p.dims),
+        data_traits<data_t>::data_type);
+
+    src1_.init(desc);
+    src2_.init(desc);
+
+    fill_data<data_t>(
+        src1_.get_size() / sizeof(data_t),
+        reinterpret_cast<data_t *>(src1_.get_data_handle()),
+        data_t(0), data_t(1));
+
+    fill_data<data_t>(
+        src2_.get_size() / sizeof(data_t),
+        reinterpret_cast<data_t *>(src2_.get_data_handle()),
+        data_t(0), data_t(1));
+  }
+
+  void Add() {
+    tensor dst;
+    dst.init(src1_.get_descriptor());
+    eltwise_binary::compute(eltwise_binary::ELTWISE_ADD, src1_, src2_, dst);
+
+    auto *a = static_cast<data_t *>(src1_.get_data_handle());
+    auto *b = static_cast<data_t *>(src2_.get_data_handle());
+    auto *c = static_cast<data_t *>(dst.get_data_handle());
+    for (auto i = 0; i < dst.get_nelems(); i++)
+      ASSERT_NEAR(c[i], a[i] + b[i], 1e-6) << "Index: " << i;
+  }
+
+  template<class fast_math_t>
+  void InvSqrtVar() {
+    float epsilon = 1e-5f;
+    tensor dst;
+    dst.init(src1_.get_descriptor());
+    auto *var = static_cast<data_t *>(src1_.get_data_handle());
+    auto *inv = static_cast<data_t *>(dst.get_data_handle());
+    auto nelems = static_cast<unsigned>(src1_.get_nelems());
+
+    fast_math_t::template inv_sqrt_var<data_t>(epsilon, var, inv, nelems);
+
+    for (unsigned i = 0; i < nelems; i++) {
+      if (var[i] < 0)
+        continue;
+      data_t ref = 1.f / std::sqrt(var[i] + epsilon);
+      ASSERT_NEAR((inv[i] - ref) / ref, 0.0, 1e-4) << "Index: " << i;
+    }
+  }
+
+  tensor src1_, src2_;
+};
+
+using fast_math_test_float = fast_math_tests<float>;
+
+TEST_P(fast_math_test_float, TestsAdd) {
+#ifdef __AVX2__
+  TestCommon();
+  Add();
+#endif
+}
+
+TEST_P(fast_math_test_float, TestsInvSqrtVar) {
+#ifdef __AVX2__
+  TestCommon();
+  InvSqrtVar<FM_AVX2_PREF>();
+  InvSqrtVar<FM_PREF>();
+#endif
+}
+
+TEST_P(fast_math_test_float, TestsInvSqrtVarAVX512) {
+#ifdef IDEEP_FM_AVX512
+  if (!ideep::utils::mayiuse(ideep::utils::avx512_common))
+    return;
+  TestCommon();
+  InvSqrtVar<FM_AVX512_PREF>();
+#endif
+}
+
+INSTANTIATE_TEST_CASE_P(
+    TestFastMath, fast_math_test_float, ::testing::Values(
+  // single thread path, with masked tail
+  fast_math_test_params{ {1, 3, 7, 11} },
+  // just above the threading threshold
+  fast_math_test_params{ {1, 1, 1, 1025} },
+  // multi-threaded, cache line aligned chunks only
+  fast_math_test_params{ {32, 64, 28, 28} },
+  // multi-threaded, residue on the last chunk
+  fast_math_test_params{ {3, 67, 55, 57} }
+));
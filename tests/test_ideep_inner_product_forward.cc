@@ -74,6 +74,37 @@ TEST_P(inner_product_test_float, TestsForward) {
   compare_tensor<float>(dst_ref_, dst);
 }
 
+TEST_P(inner_product_test_float, TestsPrepackedWeights) {
+  auto p = ::testing::TestWithParam<inprod_test_forward_params>::GetParam();
+  bool with_bias = p.bias_format != mkldnn::memory::format::format_undef;
+
+  fill_tensor(src_);
+  fill_tensor(weights_);
+  if (with_bias)
+    fill_tensor(bias_);
+
+  tensor packed, dst;
+  auto test = [&] () {
+    packed = inner_product_forward::prepack_weights(
+        src_.get_dims(), weights_);
+    if (with_bias)
+      inner_product_forward::compute(src_, packed, bias_, dst);
+    else
+      inner_product_forward::compute(src_, packed, dst);
+  };
+
+  if (catch_ideep_expected_failures(test, p.expect_to_fail, p.expected_status))
+    return;
+
+  auto again = inner_product_forward::prepack_weights(
+      src_.get_dims(), packed);
+  EXPECT_EQ(again.get_data_handle(), packed.get_data_handle());
+
+  compute_ref_inner_product_fwd<float>(
+      p.test_ipd, src_, weights_, bias_, dst_ref_);
+  compare_tensor<float>(dst_ref_, dst);
+}
+
 using inprod_test_params_float = inprod_test_forward_params;
 
 INSTANTIATE_TEST_CASE_P(TestInnerProductForwardNoBias, inner_product_test_float,
@@ -0,0 +1,98 @@
+#define _IDEEP4PY_WEB_OPT_ true
+
+#include <numeric>
+#include <mkldnn_test_common.hpp>
+#include <gtest/gtest.h>
+#include <ideep.hpp>
+#include "test_ideep_common.hpp"
+
+using namespace ideep;
+
+// Lazy convolution followed by relu, an in-place residual sum and batch
+// normalization. Each pair runs fused and must match the eager result.
+class web_fusion_test : public ::testing::Test {
+protected:
+  using scratch_allocator = utils::scratch_allocator;
+  using optimizer = utils::computation_web::dag_optimizer<tensor>;
+  using fusion_type_t = optimizer::fusion_type_t;
+
+  void SetUp() override {
+    src_.init(tensor::descriptor({2, 16, 13, 13},
+        mkldnn::memory::data_type::f32, ideep::nchw));
+    weights_.init(tensor::descriptor({16, 16, 3, 3},
+        mkldnn::memory::data_type::f32, ideep::oihw));
+    fill_tensor(src_);
+    fill_tensor(weights_);
+    optimizer::reset_report();
+  }
+
+  template <bool web_opt>
+  tensor conv(const tensor& src) {
+    tensor dst;
+    convolution_forward::compute<scratch_allocator, web_opt>(
+        src, weights_, tensor::dims{2, 16, 13, 13}, dst,
+        tensor::dims{1, 1}, tensor::dims{0, 0},
+        tensor::dims{1, 1}, tensor::dims{1, 1});
+    return dst;
+  }
+
+  size_t fused(fusion_type_t ftype) {
+    return optimizer::report(ftype).fused;
+  }
+
+  tensor src_, weights_;
+};
+
+TEST_F(web_fusion_test, TestsConvRelu) {
+  tensor ref;
+  eltwise_forward::compute<scratch_allocator, false>(conv<false>(src_), ref);
+
+  tensor dst;
+  eltwise_forward::compute<scratch_allocator, true>(conv<true>(src_), dst);
+  compare_tensor<float>(ref, dst);
+  ASSERT_EQ(fused(fusion_type_t::CN_FUSION_RELU), 1);
+}
+
+TEST_F(web_fusion_test, TestsConvSum) {
+  // The residual is in the convolution's dst format, so it accumulates
+  // in place
+  auto ref = conv<false>(src_);
+  auto residual = conv<false>(ref);
+  sum::compute<scratch_allocator, false>({1.0, 1.0}, {ref, conv<false>(src_)},
+      ref);
+
+  auto dst = conv<false>(src_);
+  auto handle = dst.get_data_handle();
+  sum::compute<scratch_allocator, true>({1.0, 1.0}, {dst, conv<true>(src_)},
+      dst);
+  compare_tensor<float>(ref, dst);
+  ASSERT_EQ(dst.get_data_handle(), handle);
+  ASSERT_EQ(fused(fusion_type_t::CN_FUSION_SUM), 1);
+
+  // A scaled convolution output can't be a post op
+  sum::compute<scratch_allocator, true>({1.0, 0.5}, {residual,
+      conv<true>(src_)}, residual);
+  (void)residual.get_data_handle();
+  ASSERT_EQ(fused(fusion_type_t::CN_FUSION_SUM), 1);
+}
+
+TEST_F(web_fusion_test, TestsConvBatchNormalization) {
+  tensor::descriptor stat_desc({16}, mkldnn::memory::data_type::f32);
+  tensor mean(stat_desc), variance(stat_desc), scale(stat_desc),
+    shift(stat_desc);
+  fill_tensor(mean);
+  fill_data<float>(16, static_cast<float *>(variance.get_data_handle()),
+      1.0f, 0.2f);
+  fill_tensor(scale);
+  fill_tensor(shift);
+
+  tensor ref;
+  batch_normalization_forward_inference::compute<scratch_allocator, false>(
+      conv<false>(src_), mean, variance, scale, shift, ref, 1e-5);
+
+  tensor dst;
+  batch_normalization_forward_inference::compute<scratch_allocator, true>(
+      conv<true>(src_), mean, variance, scale, shift, dst, 1e-5);
+  compare_tensor<float>(ref, dst);
+  ASSERT_EQ(fused(fusion_type_t::CN_FUSION_BN), 1);
+}
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <thread>
 #include <ideep/lru_cache.hpp>
 
 using namespace ideep;
@@ -82,11 +83,109 @@ void test_to_bytestring() {
   std::cout<<std::endl;
 }
 
+void test_create_key() {
+  tensor::dims A {2, 22, 228, 228};
+  tensor::dims B {2, 8, 22, 23};
+  float alpha = 0.5;
+
+  auto key = create_key(A, B, alpha, 3);
+  auto same = create_key(A, B, alpha, 3);
+  auto other = create_key(A, B, alpha, 4);
+  // Temporaries are hashed the same as named arguments
+  auto moved = create_key(tensor::dims(A), tensor::dims(B), alpha, 3);
+
+  printf("key size: %d\n", static_cast<int>(sizeof(key)));
+  printf("empty: %d, same: %d, other: %d, moved: %d\n",
+      key.empty(), key == same, key == other, key == moved);
+}
+
+struct counted_comp : public computation_cache<counted_comp> {
+  counted_comp() = default;
+  counted_comp(int v) : value(v) { created ++; }
+
+  static int compute(int v) {
+    auto key = create_key(v);
+    fetch_or_create_m(comp, key, v);
+    return comp.value;
+  }
+
+  int value = 0;
+  static std::atomic<int> created;
+};
+
+std::atomic<int> counted_comp::created(0);
+
 void test_cache() {
 }
 
+void test_shared_cache() {
+  counted_comp::set_shared(true);
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < 4; t ++) {
+    workers.emplace_back([]() {
+      for (int i = 0; i < 100; i ++) {
+        if (counted_comp::compute(i % 10) != i % 10)
+          printf("Wrong computation fetched\n");
+      }
+    });
+  }
+  for (auto &w : workers)
+    w.join();
+
+  printf("Created %d computations for 10 keys on 4 threads\n",
+      counted_comp::created.load());
+}
+
+void test_cache_manifest() {
+  cache_manifest::start_recording();
+  for (int i = 10; i < 15; i ++)
+    counted_comp::compute(i);
+  cache_manifest::stop_recording();
+  cache_manifest::save("test_lru_cache.manifest");
+
+  auto before = counted_comp::created.load();
+  auto replayed = cache_manifest::warm_up("test_lru_cache.manifest", 2);
+  printf("Recorded %d, replayed %d, created %d\n",
+      static_cast<int>(cache_manifest::size()), static_cast<int>(replayed),
+      counted_comp::created.load() - before);
+}
+
+void test_cache_stats() {
+  counted_comp::set_shared(false);
+  counted_comp::reset_stats();
+  counted_comp::set_capacity(4);
+
+  for (int i = 0; i < 16; i ++)
+    counted_comp::compute(i % 6);
+
+  auto stats = counted_comp::stats();
+  printf("hits %d, misses %d, evictions %d, capacity %d\n",
+      static_cast<int>(stats.hits), static_cast<int>(stats.misses),
+      static_cast<int>(stats.evictions), static_cast<int>(stats.capacity));
+}
+
+void test_tuning_table() {
+  tuning_table::clear();
+  tuning_table::insert(create_key(1, 3, 3), 7);
+  tuning_table::insert(create_key(1, 5, 5), 9);
+  tuning_table::save("test_lru_cache.tuning");
+
+  tuning_table::clear();
+  auto loaded = tuning_table::load("test_lru_cache.tuning");
+  int choice = 0;
+  auto found = tuning_table::find(create_key(1, 5, 5), choice);
+  printf("Loaded %d choices, found %d, choice %d\n",
+      static_cast<int>(loaded), static_cast<int>(found), choice);
+}
+
 int main() {
   test_lru();
   test_to_string();
   test_to_bytestring();
+  test_create_key();
+  test_shared_cache();
+  test_cache_manifest();
+  test_cache_stats();
+  test_tuning_table();
 }